@@ -1,7 +1,7 @@
 // File: 'RobotoMono-Regular.ttf' (114624 bytes)
 // Exported using binary_to_compressed_c.cpp
-static const unsigned int RobotoMono-Regular_compressed_size = 85122;
-static const unsigned int RobotoMono-Regular_compressed_data[85124/4] =
+static const unsigned int RobotoMono_Regular_compressed_size = 85122;
+static const unsigned int RobotoMono_Regular_compressed_data[85124/4] =
 {
     0x0000bc57, 0x00000000, 0xc0bf0100, 0x00000400, 0x00010025, 0x82100000, 0x00042e04, 0x45444700, 0x0b310b46, 0x01000032, 0x2815820c, 0x55534740, 
     0xdf11e642, 0x300f8213, 0x0200004c, 0x2f534f48, 0xead5ba32, 0x03000096, 0x281f8294, 0x616d6360, 0xa2e75370, 0x300f822f, 0x080000f4, 0x7476636a, 
@@ -0,0 +1,521 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+#include "flog.h"
+#include "atlas.h"
+
+/*
+ * Everything format_sample() and the line2 composition can produce,
+ * printable ASCII covers the digits, sign, decimal point and unit
+ * letters, the rest are the uu, dd and oo prefixes/units
+ */
+static const uint32_t atlas_extra[] = { 0x00B5, 0x00B0, 0x03A9, 0 };
+
+/*
+ * Pull the next codepoint out of a UTF-8 string, advancing *s.
+ * Malformed sequences come back as '?' one byte at a time.
+ */
+uint32_t utf8_next( const char **s ) {
+	const unsigned char *p = (const unsigned char *)*s;
+	uint32_t cp;
+	int extra, i;
+
+	if (p[0] < 0x80) { *s += 1; return p[0]; }
+	else if ((p[0] & 0xE0) == 0xC0) { cp = p[0] & 0x1F; extra = 1; }
+	else if ((p[0] & 0xF0) == 0xE0) { cp = p[0] & 0x0F; extra = 2; }
+	else if ((p[0] & 0xF8) == 0xF0) { cp = p[0] & 0x07; extra = 3; }
+	else { *s += 1; return '?'; }
+
+	for (i = 1; i <= extra; i++) {
+		if ((p[i] & 0xC0) != 0x80) { *s += 1; return '?'; }
+		cp = (cp << 6) | (p[i] & 0x3F);
+	}
+	*s += extra +1;
+
+	return cp;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: atlas_rasterise
+  Returns Type	: int
+  ----Parameter List
+  1. struct atlas_s *a, atlas to fill in
+  2. TTF_Font *font, opened at the size we'll be drawing at
+  ------------------
+  Exit Codes	: 0 - ok, 1 - failed ( a->sheet is NULL )
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Each glyph is rasterised on its own and shelf packed in to one
+  surface, a->sheet.  This is the only time FreeType gets involved
+  for this font/size.  No renderer is needed so it can be done away
+  from the render thread, atlas_upload() turns it in to a texture.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int atlas_rasterise( struct atlas_s *a, TTF_Font *font ) {
+	SDL_Surface *cells[ATLAS_GLYPHS_MAX];
+	SDL_Surface *sheet;
+	SDL_Color white = { 255, 255, 255, 255 };
+	int x, y, row_h, i;
+	uint32_t cp;
+
+	a->texture = NULL;
+	a->sheet = NULL;
+	a->w = a->h = 0;
+	a->count = 0;
+	a->extra = 0;
+	a->height = TTF_FontHeight(font);
+	for (i = 0; i < 128; i++) a->ascii[i] = -1;
+
+	// Rasterise
+	//
+	//
+	for (i = 0; ; i++) {
+		SDL_Surface *cell;
+		struct atlas_glyph_s *g;
+		int advance = 0;
+
+		// Glyphs the font lacks are skipped, so the extras don't
+		// necessarily start at 127 -32
+		//
+		if (i == 127 -32) a->extra = a->count;
+		if (i < 127 -32) cp = 32 +i;
+		else if (atlas_extra[i -(127 -32)]) cp = atlas_extra[i -(127 -32)];
+		else break;
+
+		if (a->count >= ATLAS_GLYPHS_MAX) break;
+		if (!TTF_GlyphIsProvided32(font, cp)) continue;
+
+		cell = TTF_RenderGlyph32_Blended(font, cp, white);
+		if (!cell) {
+			flog("atlas: could not render glyph U+%04X (%s)\n", cp, TTF_GetError());
+			continue;
+		}
+		TTF_GlyphMetrics32(font, cp, NULL, NULL, NULL, NULL, &advance);
+
+		g = &(a->glyphs[a->count]);
+		g->cp = cp;
+		g->advance = advance;
+		g->src.w = cell->w;
+		g->src.h = cell->h;
+		if (cp < 128) a->ascii[cp] = a->count;
+		cells[a->count++] = cell;
+	}
+
+	// Shelf pack, 1px gutter so linear filtering doesn't bleed
+	//
+	//
+	x = y = row_h = 0;
+	for (i = 0; i < a->count; i++) {
+		SDL_Rect *r = &(a->glyphs[i].src);
+
+		if (x +r->w > ATLAS_WIDTH) {
+			x = 0;
+			y += row_h +1;
+			row_h = 0;
+		}
+		r->x = x;
+		r->y = y;
+		x += r->w +1;
+		if (r->h > row_h) row_h = r->h;
+	}
+	a->w = ATLAS_WIDTH;
+	a->h = y +row_h;
+
+	sheet = SDL_CreateRGBSurfaceWithFormat(0, a->w, a->h > 0 ? a->h : 1, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (sheet) {
+		SDL_FillRect(sheet, NULL, 0);
+		for (i = 0; i < a->count; i++) {
+			SDL_Rect dst = a->glyphs[i].src;
+			SDL_SetSurfaceBlendMode(cells[i], SDL_BLENDMODE_NONE);
+			SDL_BlitSurface(cells[i], NULL, sheet, &dst);
+		}
+	}
+
+	for (i = 0; i < a->count; i++) SDL_FreeSurface(cells[i]);
+
+	if (!sheet) {
+		flog("atlas: could not create %dx%d atlas surface (%s)\n", a->w, a->h, SDL_GetError());
+		return 1;
+	}
+	a->sheet = sheet;
+
+	return 0;
+}
+
+/*
+ * Create the texture from the rasterised sheet, again after a
+ * device reset has taken the old one away
+ */
+int atlas_upload( struct atlas_s *a, SDL_Renderer *renderer ) {
+	if (a->texture) SDL_DestroyTexture(a->texture);
+	a->texture = NULL;
+	if (!a->sheet) return 1;
+
+	a->texture = SDL_CreateTextureFromSurface(renderer, a->sheet);
+	if (!a->texture) {
+		flog("atlas: could not create %dx%d atlas texture (%s)\n", a->w, a->h, SDL_GetError());
+		return 1;
+	}
+	SDL_SetTextureBlendMode(a->texture, SDL_BLENDMODE_BLEND);
+
+	flog("atlas: %d glyphs packed in to %dx%d\n", a->count, a->w, a->h);
+
+	return 0;
+}
+
+int atlas_build( struct atlas_s *a, SDL_Renderer *renderer, TTF_Font *font ) {
+	if (atlas_rasterise(a, font) != 0) return 1;
+
+	return atlas_upload(a, renderer);
+}
+
+void atlas_free( struct atlas_s *a ) {
+	if (a->texture) SDL_DestroyTexture(a->texture);
+	if (a->sheet) SDL_FreeSurface(a->sheet);
+	a->texture = NULL;
+	a->sheet = NULL;
+	a->count = 0;
+}
+
+const struct atlas_glyph_s *atlas_glyph( struct atlas_s *a, uint32_t cp ) {
+	int i;
+
+	if (cp < 128) return (a->ascii[cp] < 0) ? NULL : &(a->glyphs[a->ascii[cp]]);
+
+	for (i = a->extra; i < a->count; i++) {
+		if (a->glyphs[i].cp == cp) return &(a->glyphs[i]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Same job as TTF_SizeUTF8() but from the atlas metrics
+ */
+int atlas_text_size( struct atlas_s *a, const char *text, int *w, int *h ) {
+	int width = 0;
+
+	while (*text) {
+		const struct atlas_glyph_s *g = atlas_glyph(a, utf8_next(&text));
+		if (g) width += g->advance;
+	}
+	if (w) *w = width;
+	if (h) *h = a->height;
+
+	return 0;
+}
+
+/*
+ * Quad batch being built, only ever touched from the render thread
+ */
+static SDL_Vertex atlas_verts[ATLAS_BATCH_MAX *4];
+static int atlas_idx[ATLAS_BATCH_MAX *6];
+
+static void atlas_flush( struct atlas_s *a, SDL_Renderer *renderer, int quads ) {
+	if (!quads) return;
+
+	SDL_RenderGeometry(renderer, a->texture, atlas_verts, quads *4, atlas_idx, quads *6);
+}
+
+/*
+ * Fill in the two triangles for one glyph, as quad number n of the batch
+ */
+static void atlas_quad( struct atlas_s *a, int n, const struct atlas_glyph_s *g, float x0, float y0, SDL_Color color ) {
+	SDL_Vertex *v = atlas_verts +(n *4);
+	int *ix = atlas_idx +(n *6);
+	float iw = 1.0f / a->w;
+	float ih = 1.0f / a->h;
+	float x1 = x0 +g->src.w;
+	float y1 = y0 +g->src.h;
+
+	v[0].position = { x0, y0 }; v[0].tex_coord = { g->src.x *iw, g->src.y *ih };
+	v[1].position = { x1, y0 }; v[1].tex_coord = { (g->src.x +g->src.w) *iw, g->src.y *ih };
+	v[2].position = { x1, y1 }; v[2].tex_coord = { (g->src.x +g->src.w) *iw, (g->src.y +g->src.h) *ih };
+	v[3].position = { x0, y1 }; v[3].tex_coord = { g->src.x *iw, (g->src.y +g->src.h) *ih };
+	v[0].color = v[1].color = v[2].color = v[3].color = color;
+
+	ix[0] = n *4; ix[1] = n *4 +1; ix[2] = n *4 +2;
+	ix[3] = n *4; ix[4] = n *4 +2; ix[5] = n *4 +3;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: atlas_draw
+  Returns Type	: int
+  ----Parameter List
+  1. struct atlas_s *a,
+  2. SDL_Renderer *renderer,
+  3. const char *text, UTF-8
+  4. int x, top left of the text
+  5. int y,
+  6. SDL_Color color,
+  ------------------
+  Exit Codes	: width drawn in pixels
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Builds two triangles per glyph and hands them to the renderer
+  in batches of ATLAS_BATCH_MAX.  Codepoints not in the atlas are
+  skipped.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int atlas_draw( struct atlas_s *a, SDL_Renderer *renderer, const char *text, int x, int y, SDL_Color color ) {
+	int pen = x;
+	int quads = 0;
+
+	if (!a->texture) return 0;
+
+	while (*text) {
+		const struct atlas_glyph_s *g = atlas_glyph(a, utf8_next(&text));
+
+		if (!g) continue;
+
+		if (quads == ATLAS_BATCH_MAX) {
+			atlas_flush(a, renderer, quads);
+			quads = 0;
+		}
+
+		atlas_quad(a, quads++, g, pen, y, color);
+		pen += g->advance;
+	}
+
+	atlas_flush(a, renderer, quads);
+
+	return pen -x;
+}
+
+/*
+ * Draw cells [from, to) of a line that's already been laid out
+ */
+static void atlas_draw_cells( struct atlas_s *a, SDL_Renderer *renderer, struct atlas_line_s *l, int from, int to, SDL_Color color ) {
+	int quads = 0;
+	int i;
+
+	if (from < 0) from = 0;
+	if (to > l->ncells) to = l->ncells;
+
+	for (i = from; i < to; i++) {
+		const struct atlas_glyph_s *g = atlas_glyph(a, l->cells[i]);
+
+		if (!g) continue;
+
+		if (quads == ATLAS_BATCH_MAX) {
+			atlas_flush(a, renderer, quads);
+			quads = 0;
+		}
+
+		atlas_quad(a, quads++, g, l->cell_x[i], 0, color);
+	}
+
+	atlas_flush(a, renderer, quads);
+}
+
+
+/*
+ * Retained lines
+ *
+ */
+void atlas_line_init( struct atlas_line_s *l ) {
+	l->texture = NULL;
+	l->tw = l->th = 0;
+	l->w = 0;
+	l->ncells = 0;
+	l->cell_x[0] = 0;
+	l->damaged = 0;
+	l->text[0] = '\0';
+	l->valid = false;
+}
+
+void atlas_line_free( struct atlas_line_s *l ) {
+	if (l->texture) SDL_DestroyTexture(l->texture);
+	atlas_line_init(l);
+}
+
+/*
+ * After the renderer has lost its targets ( SDL_RENDER_TARGETS_RESET )
+ * the texture contents are gone even though the text hasn't changed
+ */
+void atlas_line_invalidate( struct atlas_line_s *l ) {
+	l->valid = false;
+}
+
+/*
+ * Work out which glyph goes where along a line
+ */
+static int atlas_line_layout( struct atlas_s *a, const char *text, uint32_t *cells, int *cell_x ) {
+	int n = 0;
+	int pen = 0;
+
+	while (*text && n < ATLAS_LINE_CELLS) {
+		uint32_t cp = utf8_next(&text);
+		const struct atlas_glyph_s *g = atlas_glyph(a, cp);
+
+		if (!g) continue;
+		cells[n] = cp;
+		cell_x[n] = pen;
+		pen += g->advance;
+		n++;
+	}
+	cell_x[n] = pen;
+
+	return n;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: atlas_line_update
+  Returns Type	: bool
+  ----Parameter List
+  1. struct atlas_line_s *l,
+  2. struct atlas_s *a, atlas to draw the glyphs from
+  3. SDL_Renderer *renderer,
+  4. const char *text, new contents of the line
+  5. SDL_Color color,
+  ------------------
+  Exit Codes	: true if the line changed and needs to be presented
+  Side Effects	: may reallocate l->texture, l->damaged is set to the
+                 number of cells redrawn
+  --------------------------------------------------------------------
+Comments:
+  The new text is laid out in to cells and compared with what's
+  already in the texture.  Only runs of cells that differ are
+  cleared and redrawn, clipped to the run so the glyphs either side
+  ( redrawn in case they overhang in to it ) aren't blended twice.
+  A typical new reading only touches the last digit or two.
+
+  The texture only ever grows, so a reading that flips between
+  widths doesn't keep reallocating it.  Growing, or an invalidated
+  line, gets a full redraw.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+bool atlas_line_update( struct atlas_line_s *l, struct atlas_s *a, SDL_Renderer *renderer, const char *text, SDL_Color color ) {
+	uint32_t cells[ATLAS_LINE_CELLS];
+	int cell_x[ATLAS_LINE_CELLS +1];
+	SDL_Rect runs[ATLAS_LINE_CELLS];
+	int run_from[ATLAS_LINE_CELLS], run_to[ATLAS_LINE_CELLS];
+	SDL_Texture *previous;
+	SDL_BlendMode draw_blend;
+	bool full;
+	int n, w, h, i, nruns;
+
+	if (l->valid && strcmp(l->text, text) == 0) return false;
+
+	n = atlas_line_layout(a, text, cells, cell_x);
+	w = cell_x[n];
+	h = a->height;
+	if (w < 1) w = 1;
+
+	full = (!l->valid || !l->texture || w > l->tw || h != l->th);
+
+	if (!l->texture || w > l->tw || h != l->th) {
+		SDL_BlendMode premultiplied;
+
+		if (l->texture) SDL_DestroyTexture(l->texture);
+		l->tw = (w > l->tw) ? w : l->tw;
+		l->th = h;
+		l->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, l->tw, l->th);
+		if (!l->texture) {
+			flog("atlas: could not create %dx%d line texture (%s)\n", l->tw, l->th, SDL_GetError());
+			l->tw = l->th = 0;
+			return true;
+		}
+
+		// Glyphs blended on to a transparent target leave colour
+		// premultiplied by alpha, so composite it that way too.
+		// Renderers without custom blend modes get plain blending.
+		//
+		premultiplied = SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+				SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+		if (SDL_SetTextureBlendMode(l->texture, premultiplied) != 0) {
+			SDL_SetTextureBlendMode(l->texture, SDL_BLENDMODE_BLEND);
+		}
+	}
+
+	// Find the runs of cells that differ, against the old layout
+	//
+	//
+	nruns = 0;
+	if (!full) {
+		int max = (n > l->ncells) ? n : l->ncells;
+
+		i = 0;
+		while (i < max) {
+			int start, x0, x1;
+
+			if (i < n && i < l->ncells && cells[i] == l->cells[i] && cell_x[i] == l->cell_x[i]) {
+				i++;
+				continue;
+			}
+
+			start = i;
+			while (i < max && !(i < n && i < l->ncells && cells[i] == l->cells[i] && cell_x[i] == l->cell_x[i])) i++;
+
+			x0 = cell_x[(start < n) ? start : n];
+			if (l->cell_x[(start < l->ncells) ? start : l->ncells] < x0) x0 = l->cell_x[(start < l->ncells) ? start : l->ncells];
+			x1 = cell_x[(i < n) ? i : n];
+			if (l->cell_x[(i < l->ncells) ? i : l->ncells] > x1) x1 = l->cell_x[(i < l->ncells) ? i : l->ncells];
+
+			runs[nruns] = { x0, 0, x1 -x0, l->th };
+			run_from[nruns] = start;
+			run_to[nruns] = i;
+			nruns++;
+		}
+	}
+
+	memcpy(l->cells, cells, n * sizeof(cells[0]));
+	memcpy(l->cell_x, cell_x, (n +1) * sizeof(cell_x[0]));
+	l->ncells = n;
+	l->w = cell_x[n];
+
+	previous = SDL_GetRenderTarget(renderer);
+	SDL_SetRenderTarget(renderer, l->texture);
+	SDL_GetRenderDrawBlendMode(renderer, &draw_blend);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+
+	if (full) {
+		SDL_RenderClear(renderer);
+		atlas_draw_cells(a, renderer, l, 0, n, color);
+		l->damaged = n;
+	} else {
+		l->damaged = 0;
+		for (i = 0; i < nruns; i++) {
+			if (runs[i].w <= 0) continue;
+			SDL_RenderSetClipRect(renderer, &(runs[i]));
+			SDL_RenderFillRect(renderer, &(runs[i]));
+			atlas_draw_cells(a, renderer, l, run_from[i] -1, run_to[i] +1, color);
+			l->damaged += run_to[i] -run_from[i];
+		}
+		SDL_RenderSetClipRect(renderer, NULL);
+	}
+
+	SDL_SetRenderDrawBlendMode(renderer, draw_blend);
+	SDL_SetRenderTarget(renderer, previous);
+
+	snprintf(l->text, sizeof(l->text), "%s", text);
+	l->valid = true;
+
+	return true;
+}
+
+int atlas_line_draw( struct atlas_line_s *l, SDL_Renderer *renderer, int x, int y ) {
+	SDL_Rect src, dst;
+
+	if (!l->texture || l->w <= 0) return 0;
+
+	src = { 0, 0, l->w, l->th };
+	dst = { x, y, l->w, l->th };
+
+	return SDL_RenderCopy(renderer, l->texture, &src, &dst);
+}
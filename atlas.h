@@ -0,0 +1,71 @@
+#ifndef __ATLAS__
+#define __ATLAS__
+#include <stdint.h>
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+#define ATLAS_GLYPHS_MAX 128
+#define ATLAS_WIDTH 1024
+#define ATLAS_BATCH_MAX 256     // glyphs per SDL_RenderGeometry() call
+#define ATLAS_LINE_MAX 1024
+#define ATLAS_LINE_CELLS 256    // glyphs laid out per line, the rest are dropped
+
+/*
+ * Where one glyph sits in the atlas texture
+ */
+struct atlas_glyph_s {
+	uint32_t cp;            // unicode codepoint
+	SDL_Rect src;           // cell in the atlas, full font height
+	int advance;            // pen movement after this glyph
+};
+
+/*
+ * Every glyph the OSD can show, rasterised once per font and size
+ * in to a single texture.  Glyphs are rendered white and tinted by
+ * the vertex colour when drawn, so one atlas serves any colour.
+ */
+struct atlas_s {
+	SDL_Texture *texture;
+	SDL_Surface *sheet;     // the glyphs as rasterised, kept to re-upload after a device reset
+	int w, h;
+	int height;             // TTF_FontHeight() of the source font
+	int count;
+	int extra;              // glyphs[] index of the first non-ASCII glyph
+	struct atlas_glyph_s glyphs[ATLAS_GLYPHS_MAX];
+	int16_t ascii[128];     // glyphs[] index for the ASCII range, -1 if absent
+};
+
+/*
+ * One line of text kept rendered in its own target texture.  When
+ * the text changes only the glyph cells that differ are redrawn.
+ * The texture holds premultiplied alpha so it composites like the
+ * glyphs would have.
+ */
+struct atlas_line_s {
+	SDL_Texture *texture;
+	int tw, th;             // allocated texture size
+	int w;                  // width of the text currently in it
+	char text[ATLAS_LINE_MAX];
+	uint32_t cells[ATLAS_LINE_CELLS];       // codepoint in each cell
+	int cell_x[ATLAS_LINE_CELLS +1];        // left edge of each cell, [ncells] is the right edge of the line
+	int ncells;
+	int damaged;            // cells redrawn by the last update
+	bool valid;             // false forces the next update to redraw it all
+};
+
+int atlas_rasterise( struct atlas_s *a, TTF_Font *font );
+int atlas_upload( struct atlas_s *a, SDL_Renderer *renderer );
+int atlas_build( struct atlas_s *a, SDL_Renderer *renderer, TTF_Font *font );
+void atlas_free( struct atlas_s *a );
+const struct atlas_glyph_s *atlas_glyph( struct atlas_s *a, uint32_t cp );
+int atlas_text_size( struct atlas_s *a, const char *text, int *w, int *h );
+int atlas_draw( struct atlas_s *a, SDL_Renderer *renderer, const char *text, int x, int y, SDL_Color color );
+uint32_t utf8_next( const char **s );
+
+void atlas_line_init( struct atlas_line_s *l );
+void atlas_line_free( struct atlas_line_s *l );
+void atlas_line_invalidate( struct atlas_line_s *l );
+bool atlas_line_update( struct atlas_line_s *l, struct atlas_s *a, SDL_Renderer *renderer, const char *text, SDL_Color color );
+int atlas_line_draw( struct atlas_line_s *l, SDL_Renderer *renderer, int x, int y );
+
+#endif
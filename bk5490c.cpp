@@ -10,14 +10,18 @@
  *
  */
 
+#ifdef _WIN32
+#include <winsock2.h>
 #include <windows.h>
 #include <shellapi.h>
+#include <strsafe.h>
+#endif
+#include <ctype.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strsafe.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <filesystem>
@@ -26,8 +30,20 @@
 #include <SDL_ttf.h>
 #include <fstream>
 #include <iostream>
+#include <atomic>
+#include <string_view>
 #include "confparse.h"
+#include "atlas.h"
 #include "flog.h"
+#include "fontcache.h"
+#include "fontprovider.h"
+#include "frameexport.h"
+#include "perf.h"
+#include "pyramid.h"
+#include "samples.h"
+#include "trace.h"
+#include "transport.h"
+#include "trend.h"
 
 
 /*
@@ -43,19 +59,62 @@
 #define BUILD_DATE " "
 #endif
 
+#ifndef MAX_PATH
+#define MAX_PATH 260
+#endif
+
 #define WINDOWS_DPI_DEFAULT 72
 #define FONT_NAME_SIZE 1024
 #define SSIZE 1024
 
 #define FONT_SIZE_MAX 256
 #define FONT_SIZE_MIN 10
+#define STREAM_SAMPLES_MAX 256
+#define STREAM_BUFFER_SIZE (STREAM_SAMPLES_MAX * 20)
 #define DEFAULT_FONT_SIZE 72
 #define DEFAULT_FONT L"Andale"
 #define DEFAULT_FONT_WEIGHT 600
 #define DEFAULT_WINDOW_HEIGHT 9999
 #define DEFAULT_WINDOW_WIDTH 9999
-#define DEFAULT_COM_PORT 99
 #define DEFAULT_COM_SPEED 9600
+#define DEFAULT_CONF_REFRESH_INTERVAL 2000
+#define DETECT_TIMEOUT 1000
+#define DEFAULT_BAUD_COMMAND "SYST:BAUD"
+#define DEFAULT_BAUD_MAX 115200
+#define BAUD_SETTLE_TIME 100
+#define DETECT_DEADLINE 2000
+#define DEFAULT_READ_TIMEOUT 2000
+#define STREAM_SAMPLE_TIMEOUT 250
+#define LINK_RETRY_DELAY 500    // ms between cycles while the port is failing outright
+#define EVENT_WAIT_TIMEOUT 1000
+#define OSD_MIN_WIDTH 160
+#define OSD_MIN_HEIGHT 60
+#define HUD_FONT_SIZE 14
+#define HUD_LINES 4
+#define HUD_LINE_SIZE 128
+#define DEFAULT_FRAME_EXPORT_NAME "bk5490c_frames"
+#define DEFAULT_TRACE_FILE "bk5490c.trace"
+
+#define HOTKEY_VOLTS 1000
+#define HOTKEY_VOLTSAC 1001
+#define HOTKEY_AMPS 1002
+#define HOTKEY_RESISTANCE 1003
+#define HOTKEY_CONTINUITY 1004
+#define HOTKEY_DIODE 1005
+#define HOTKEY_CAPACITANCE 1006
+#define HOTKEY_FREQUENCY 1007
+#define HOTKEY_TEMPERATURE 1008
+#define HOTKEY_PROFILE 1009
+#define HOTKEY_QUIT 1015
+
+/*
+ * Our SDL user events, offsets from glb.event_base
+ */
+#define EVENT_SAMPLE 0          // acquisition thread queued new samples
+#define EVENT_HOTKEY 1          // global hotkey, code is the HOTKEY_* id
+#define EVENT_SERIAL_ERROR 2    // meter stopped answering
+#define EVENT_FONTS_READY 3     // font cache finished rasterising a new size
+#define EVENT_COUNT 4
 
 #define ee ""
 #define uu "\u00B5"
@@ -70,31 +129,58 @@
 #define ID_QUIT 1
 
 
+/*
+ * Speed / resolution trade-off for a function.  Any of the settings
+ * not applicable to a function are left as 0 ( -1 for autozero ) and
+ * are then not sent.  The SCPI is composed from mmode_s.scpi, so for
+ * "VOLT" an nplc of 1 becomes "VOLT:NPLC 1"
+ */
+#define MPROFILES_MAX 3
+
+struct mprofile_s {
+	char label[20];
+	double nplc;
+	double aperture;
+	char speed[10];
+	int autozero;
+};
+
 struct mmode_s {
 	char scpi[50];
 	char label[50];
 	char query[50];
 	char units[10];
+	int default_profile;
+	struct mprofile_s profiles[MPROFILES_MAX];
 };
 
 
 struct mmode_s mmodes[] = { 
-	{"VOLT", "Volts DC", "CONF:VOLT:DC\r\n", "V DC"},  
-	{"VOLT:AC", "Volts AC", "CONF:VOLT:AC\r\n", "V AC"},
-	{"VOLT:DCAC", "Volts DC/AC", "CONF:VOLT:DCAC\r\n", "V DC/AC"},
-	{"CURR", "Current DC", "CONF:CURR:DC\r\n", "A DC"},
-	{"CURR:AC", "Current AC", "CONF:CURR:AC\r\n", "A AC"},
-	{"CURR:DCAC", "Current DC/AC", "CONF:CURR:DCAC\r\n", "A DC/AC"},
-	{"RES", "Resistance", "CONF:RES\r\n", oo },
-	{"FREQ", "Frequency", "CONF:FREQ\r\n", "Hz" },
-	{"PER", "Period", "CONF:PER\r\n", "s"},
-	{"TEMP", "Temperature", "CONF:TEMP:RTD\r\n", "C"},
-	{"DIOD", "Diode", "CONF:DIOD\r\n", "V"},
-	{"CONT", "Continuity", "CONF:CONT\r\n", oo},
-	{"CAP", "Capacitance", "CONF:CAP\r\n", "F"}
+	{"VOLT", "Volts DC", "CONF:VOLT:DC\r\n", "V DC", 1,
+		{{"4.5d fast", 0.1, 0, "", 0}, {"5.5d", 1, 0, "", 1}, {"6.5d slow", 10, 0, "", 1}} },  
+	{"VOLT:AC", "Volts AC", "CONF:VOLT:AC\r\n", "V AC", 0,
+		{{"fast", 0, 0, "FAST", -1}, {"medium", 0, 0, "MED", -1}, {"slow", 0, 0, "SLOW", -1}} },
+	{"VOLT:DCAC", "Volts DC/AC", "CONF:VOLT:DCAC\r\n", "V DC/AC", 0,
+		{{"fast", 0, 0, "FAST", -1}, {"medium", 0, 0, "MED", -1}, {"slow", 0, 0, "SLOW", -1}} },
+	{"CURR", "Current DC", "CONF:CURR:DC\r\n", "A DC", 1,
+		{{"4.5d fast", 0.1, 0, "", 0}, {"5.5d", 1, 0, "", 1}, {"6.5d slow", 10, 0, "", 1}} },
+	{"CURR:AC", "Current AC", "CONF:CURR:AC\r\n", "A AC", 0,
+		{{"fast", 0, 0, "FAST", -1}, {"medium", 0, 0, "MED", -1}, {"slow", 0, 0, "SLOW", -1}} },
+	{"CURR:DCAC", "Current DC/AC", "CONF:CURR:DCAC\r\n", "A DC/AC", 0,
+		{{"fast", 0, 0, "FAST", -1}, {"medium", 0, 0, "MED", -1}, {"slow", 0, 0, "SLOW", -1}} },
+	{"RES", "Resistance", "CONF:RES\r\n", oo, 1,
+		{{"4.5d fast", 0.1, 0, "", 0}, {"5.5d", 1, 0, "", 1}, {"6.5d slow", 10, 0, "", 1}} },
+	{"FREQ", "Frequency", "CONF:FREQ\r\n", "Hz", 1,
+		{{"10ms gate", 0, 0.01, "", -1}, {"100ms gate", 0, 0.1, "", -1}, {"1s gate", 0, 1, "", -1}} },
+	{"PER", "Period", "CONF:PER\r\n", "s", 1,
+		{{"10ms gate", 0, 0.01, "", -1}, {"100ms gate", 0, 0.1, "", -1}, {"1s gate", 0, 1, "", -1}} },
+	{"TEMP", "Temperature", "CONF:TEMP:RTD\r\n", "C", 1,
+		{{"fast", 0.1, 0, "", 0}, {"normal", 1, 0, "", 1}, {"slow", 10, 0, "", 1}} },
+	{"DIOD", "Diode", "CONF:DIOD\r\n", "V", 0, {} },
+	{"CONT", "Continuity", "CONF:CONT\r\n", oo, 0, {} },
+	{"CAP", "Capacitance", "CONF:CAP\r\n", "F", 0, {} }
 };
 
-char SCPI_RES_ZERO_ON[] = "RES:ZERO:AUTO ON\r\n";
 char SCPI_FUNC[] = "SENS:FUNC1?\r\n";
 char SCPI_VAL1[] = "VAL1?\r\n";
 char SCPI_VAL2[] = "VAL2?\r\n";
@@ -104,13 +190,15 @@ char SCPI_REMOTE[] = "SYST:REM\r\n";
 char SCPI_RANGE[] = "CONF:RANG?\r\n";
 char SCPI_CONF[] = "CONF?\r\n";
 char SCPI_READ[] = "READ?\r\n";
+char SCPI_INIT[] = "INIT\r\n";
+char SCPI_FETCH[] = "FETC?\r\n";
+char SCPI_TRIG_IMM[] = "TRIG:SOUR IMM\r\n";
 char SCPI_BEEP_ON[] = "SYST:BEEP:STAT 1\r\n";
 char SCPI_BEEP_OFF[] = "SYST:BEEP:STAT 0\r\n";
 char SCPI_BEEP[] = "SYST:BEEP\r\n";
 char SCPI_BEEP_FORCE[] = "SYST:BEEP:STAT 1\r\nSYST:BEEP\r\nSYST:BEEP:STAT 0\r\n";
-char SCPI_VAC_FAST[] = "VOLT:AC:SPEE FAST\r\n";
-char SCPI_VDC_FAST[] = "VOLT:NPLC 1\r\n";
 char SCPI_IDN[] = "*IDN?\r\n";
+char SCPI_OPC[] = "*OPC?\r\n";
 char SCPI_RST[] = "*RST\r\n";
 
 
@@ -139,9 +227,55 @@ struct metermode_s {
 	char mode_query_str[128];
 };
 
+/*
+ * A batch of SCPI commands to be sent in a single write, with
+ * the replies matched back up in the order they were queued
+ */
+#define SCPI_PIPELINE_MAX 8
+
+#define SCPI_EXPECT_NONE 0      // no reply
+#define SCPI_EXPECT_ANY 1       // any non-empty reply, ie *IDN?
+#define SCPI_EXPECT_NUMBER 2    // a single reading, ie READ?
+#define SCPI_EXPECT_NUMBERS 3   // comma separated readings, ie FETC?
+#define SCPI_EXPECT_CONF 4      // function,range,resolution from CONF?
+
+struct scpi_req_s {
+	const char *cmd;
+	char *response;         // NULL if the command has no reply
+	size_t response_size;
+	int expect;             // SCPI_EXPECT_*, used to spot replies that aren't ours
+	int timeout_ms;         // added to the previous request's deadline
+	bool ok;                // a valid reply arrived before the deadline
+};
+
+struct scpi_pipeline_s {
+	struct scpi_req_s req[SCPI_PIPELINE_MAX];
+	int count;
+};
+
+/*
+ * Last known meter configuration as reported by CONF?
+ *
+ * This only changes when we switch modes or someone fiddles with
+ * the front panel so we keep a copy and only re-query it after a
+ * mode change or once conf_refresh_interval has elapsed.
+ */
+struct meter_conf_s {
+	char raw[SSIZE];
+	char mode_str[20];
+	double range;
+	double precision;
+	uint64_t fetched;       // SDL ticks (ms) of the last CONF? reply
+	bool valid;
+};
+
 struct glb {
 
-	HANDLE hComm;
+	Transport *xport;
+	char port_name[TRANSPORT_NAME_SIZE]; // serial device, "" to auto-detect
+	char tcp_host[TRANSPORT_NAME_SIZE]; // if set, talk SCPI-raw over TCP instead
+	int tcp_port;
+	char idn[SSIZE];
 
 	int wx_forced, wy_forced;
 	int window_x, window_y;
@@ -151,14 +285,49 @@ struct glb {
 	uint8_t quiet;
 	uint8_t show_mode;
 	uint16_t flags;
-	uint8_t com_address;
 
 	std::filesystem::path line1_font_filename, line2_font_filename;
 	TTF_Font *line1_font, *line2_font;
+	struct fontcache_s fonts; // glyph atlases for the window size and the last few before it
+	struct atlas_s *line1_atlas, *line2_atlas; // from the fonts entry currently on screen
+	int line1_font_want, line2_font_want; // point sizes the window size calls for
+	int text_width, text_height; // text area at line1_font_size / line2_font_size
+	struct atlas_line_s line1_cache, line2_cache;
+
+	bool trend_enable; // strip chart of recent readings below line2
+	int trend_height;
+	int trend_seconds;
+	SDL_Color trend_color;
+	SDL_Rect trend_pane;
+	uint64_t last_ts; // newest reading the render thread has seen, where the trend view ends
+	struct pyramid_s pyramid; // min/max/mean summary of the current function's readings, for the trend view
+	int pyramid_mode;
+	int pyramid_mb;
+	struct trend_s trend;
+
+	bool hud_enable; // performance overlay, toggled with 'h'
+	struct perf_s perf;
+	struct perf_snapshot_s perf_last;
+	struct atlas_s hud_atlas;
+	char hud_text[HUD_LINES][HUD_LINE_SIZE];
+
+	bool trace_enable; // record spans for a chrome://tracing / Perfetto view
+	size_t trace_events;
+	std::filesystem::path trace_filename;
+	std::filesystem::path trace_convert; // -J, turn this trace in to JSON and exit
+	bool selftest; // -T, run the built in checks and exit
+
+	bool headless; // render offscreen and export frames rather than open a window
+	char frame_export_name[FRAME_EXPORT_NAME_SIZE];
 	SDL_Color line1_color, line2_color, background_color;
 	int line1_font_size, line2_font_size;
 
-	char serial_params[SSIZE];
+	char serial_params[SSIZE]; // baud[:framing[:flow]] as given, see serial_params_parse()
+	struct serial_params_s sp;
+	bool baud_negotiate;
+	int baud_max;
+	int baud_base; // rate the meter was found at, restored on exit
+	char baud_command[SSIZE];
 
 	bool mmdata_enable;
 	std::filesystem::path mmdata_output_file[MAX_PATH];
@@ -171,6 +340,23 @@ struct glb {
 	 
 	bool system_beep;
 
+	int conf_refresh_interval; // ms between background CONF? refreshes
+	int stream_samples; // readings per trigger, <= 1 uses plain READ?
+	int read_timeout; // ms to wait for a reply before resyncing
+	int profile_sel[MMODES_MAX]; // current speed profile for each function, owned by the acquisition thread
+
+	/*
+	 * Shared between the render thread and the acquisition thread
+	 */
+	struct sampleq_s *samples;
+	std::atomic<int> mode_request; // MMODES_* to switch to, -1 for none
+	std::atomic<bool> acq_paused;
+	std::atomic<bool> acq_quit;
+	SDL_sem *acq_wake; // posted when acq_paused/acq_quit change
+	std::atomic<int> profile_cycle; // non-zero to step the current function's speed profile
+	Uint32 event_base; // from SDL_RegisterEvents(), (Uint32)-1 if we didn't get any
+	std::atomic<bool> sample_event_pending; // an EVENT_SAMPLE is already sitting in the SDL queue
+
 };
 
 /*
@@ -206,20 +392,46 @@ int init(struct glb *g) {
 	g->quiet = 0;
 	g->show_mode = 0;
 	g->flags = 0;
-	g->com_address = DEFAULT_COM_PORT;
+	g->xport = NULL;
+	g->port_name[0] = '\0';
+	g->tcp_host[0] = '\0';
+	g->tcp_port = DEFAULT_TCP_PORT;
+	g->idn[0] = '\0';
 	g->mmdata_enable = false;
+	g->headless = false;
+	g->hud_enable = false;
+	perf_init(&(g->perf));
+	g->trace_enable = false;
+	g->trace_events = TRACE_EVENTS_DEFAULT;
+	g->trace_filename = DEFAULT_TRACE_FILE;
+	g->selftest = false;
+	g->perf_last = {};
+	for (int i = 0; i < HUD_LINES; i++) g->hud_text[i][0] = '\0';
+	g->trend_enable = false;
+	g->trend_height = DEFAULT_TREND_HEIGHT;
+	g->trend_seconds = DEFAULT_TREND_SECONDS;
+	g->trend_color = { 10, 200, 10, 255 };
+	g->last_ts = 0;
+	g->pyramid_mode = -1;
+	g->pyramid_mb = DEFAULT_PYRAMID_MB;
+	snprintf(g->frame_export_name, sizeof(g->frame_export_name), "%s", DEFAULT_FRAME_EXPORT_NAME);
 
 	g->window_width = 500;
 	g->window_height = 120;
 	g->wx_forced = 0;
 	g->wy_forced = 0;
 
-	g->line1_color =  { 10, 200, 10 };
-	g->line2_color =  { 200, 200, 10 };
-	g->background_color = { 0, 0, 0 };
+	g->line1_color =  { 10, 200, 10, 255 };
+	g->line2_color =  { 200, 200, 10, 255 };
+	g->background_color = { 0, 0, 0, 255 };
 
 
 	g->serial_params[0] = '\0';
+	serial_params_parse(DEFAULT_SERIAL_PARAMS, &(g->sp));
+	g->baud_negotiate = false;
+	g->baud_max = DEFAULT_BAUD_MAX;
+	g->baud_base = g->sp.baud;
+	snprintf(g->baud_command, sizeof(g->baud_command), "%s", DEFAULT_BAUD_COMMAND);
 
 	g->cont_beep_enabled = true;
 	g->cont_threshold = 1.0;
@@ -228,6 +440,22 @@ int init(struct glb *g) {
 	g->diode_threshold = 0.05;
 	g->system_beep = false;
 
+	g->conf_refresh_interval = DEFAULT_CONF_REFRESH_INTERVAL;
+	g->stream_samples = 0;
+	g->read_timeout = DEFAULT_READ_TIMEOUT;
+
+	g->samples = new sampleq_s;
+	sampleq_init(g->samples);
+	g->mode_request.store(-1);
+	g->acq_paused.store(false);
+	g->acq_quit.store(false);
+	g->acq_wake = SDL_CreateSemaphore(0);
+	g->profile_cycle.store(0);
+	g->event_base = (Uint32)-1;
+	g->sample_event_pending.store(false);
+
+	for (int i = 0; i < MMODES_MAX; i++) g->profile_sel[i] = mmodes[i].default_profile;
+
 	return 0;
 }
 
@@ -259,16 +487,9 @@ Comments:
 Changes:
 
 \------------------------------------------------------------------*/
-int parse_parameters(struct glb *g) {
-	LPWSTR *argv;
-	int argc;
+int parse_parameters(struct glb *g, int argc, char **argv) {
 	int i;
 
-	argv = CommandLineToArgvW(GetCommandLineW(), &argc);
-	if (NULL == argv) {
-		return 0;
-	}
-
 	for (i = 0; i < argc; i++) {
 		if (argv[i][0] == '-') {
 			/* parameter */
@@ -276,415 +497,1719 @@ int parse_parameters(struct glb *g) {
 
 				case 'd': g->debug = 1; break;
 
+				case 'p':
+					/*
+					 * -p 5 for COM5 ( /dev/ttyUSB5 on linux ), or the
+					 * full device name
+					 */
+					if (++i < argc) {
+						char *ep;
+						long port = strtol(argv[i], &ep, 10);
+						if (*ep == '\0') {
+#ifdef _WIN32
+							snprintf(g->port_name, sizeof(g->port_name), "COM%ld", port);
+#else
+							snprintf(g->port_name, sizeof(g->port_name), "/dev/ttyUSB%ld", port);
+#endif
+						} else {
+							snprintf(g->port_name, sizeof(g->port_name), "%s", argv[i]);
+						}
+					}
+					break;
+
+				case 'H': g->headless = true; break;
+
+				case 'J':
+					/*
+					 * -J bk5490c.trace, writes bk5490c.trace.json
+					 */
+					if (++i < argc) g->trace_convert = argv[i];
+					break;
+
+				case 'T': g->selftest = true; break;
+
+				case 's':
+					/*
+					 * -s 115200:8n1[:rtscts|xonxoff]
+					 */
+					if (++i < argc) {
+						snprintf(g->serial_params, sizeof(g->serial_params), "%s", argv[i]);
+					}
+					break;
+
+				case 't':
+					/*
+					 * -t host[:port] for SCPI-raw over TCP
+					 */
+					if (++i < argc) {
+						char *p;
+						snprintf(g->tcp_host, sizeof(g->tcp_host), "%s", argv[i]);
+						p = strrchr(g->tcp_host, ':');
+						if (p) {
+							*p = '\0';
+							g->tcp_port = atoi(p +1);
+						}
+					}
+					break;
+
 				default: break;
 			} // switch
 		}
 	}
 
-	LocalFree(argv);
-
 	return 0;
 }
 
 int purge_coms(struct glb *pg) {
 
-	flog("Clearing all prior comms and buffers on port COM%d\n",  pg->com_address);
-	PurgeComm( pg->hComm, PURGE_RXABORT|PURGE_RXCLEAR|PURGE_TXABORT|PURGE_TXCLEAR);
+	flog("Clearing all prior comms and buffers on port %s\n",  pg->xport->name);
+	pg->xport->Purge();
 
-	flog("Port COM%d open and ready\n", pg->com_address);
+	flog("Port %s open and ready\n", pg->xport->name);
 
 	return 0;
 
 }
 
-int enable_coms(struct glb *pg, int port) {
-	wchar_t com_port[SSIZE]; // com port path / ie, \\.COM4
-	BOOL com_read_status;  // return status of various com port functions
-								  //
-	flog("enable_coms: Port #%d requested for opening...\n", port);
-
-	snwprintf(com_port, sizeof(com_port), L"COM%d", port);
-	/*
-	 * Open the serial port
-	 */
-	pg->hComm = CreateFile(com_port,      // Name of port
-			GENERIC_READ|GENERIC_WRITE,  // Read Access
-			0,             // No Sharing
-			0,          // No Security
-			OPEN_EXISTING, // Open existing port only
-			FILE_ATTRIBUTE_NORMAL,             // Non overlapped I/O
-			0);         // Null for comm devices
-
-	/*
-	 * Check the outcome of the attempt to create the handle for the com port
-	 */
-	if (pg->hComm == INVALID_HANDLE_VALUE) {
-		flog("Error while trying to open com port '%d'\r\n", pg->com_address);
-		exit(1);
-	} else {
-		if (!pg->quiet) flog("enable_comms: Port %d Opened\r\n", pg->com_address);
-	}
+int enable_coms(struct glb *pg, const char *port) {
 
-	/*
-	 * Set serial port parameters
-	 */
-	DCB dcbSerialParams = {0}; // Init DCB structure
-	dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
+	flog("enable_coms: Port %s requested for opening...\n", port);
 
-	com_read_status = GetCommState(pg->hComm, &dcbSerialParams); // Retrieve current settings
-	if (com_read_status == FALSE) {
-		flog("Error in getting GetCommState()\r\n");
-		CloseHandle(pg->hComm);
+	pg->xport = transport_open_serial(port, &(pg->sp));
+	if (!pg->xport) {
+		flog("enable_coms: Unable to open %s\n", port);
 		return 1;
 	}
 
-	dcbSerialParams.BaudRate = CBR_9600;
-	dcbSerialParams.ByteSize = 8;
-	dcbSerialParams.StopBits = ONESTOPBIT;
-	dcbSerialParams.Parity = NOPARITY;
-
-	com_read_status = SetCommState(pg->hComm, &dcbSerialParams);
-	if (com_read_status == FALSE) {
-		flog("Error setting com port configuration (9600:8n1 etc)\r\n");
-		CloseHandle(pg->hComm);
-		return 1;
-	} else {
-
-		if (!pg->quiet) {
-			flog("\tBaudrate = %ld\r\n", dcbSerialParams.BaudRate);
-			flog("\tByteSize = %ld\r\n", dcbSerialParams.ByteSize);
-			flog("\tStopBits = %d\r\n", dcbSerialParams.StopBits);
-			flog("\tParity   = %d\r\n", dcbSerialParams.Parity);
-		}
+	return 0;
+}
 
+void disable_coms(struct glb *pg) {
+	if (pg->xport) {
+		pg->xport->Close();
+		delete pg->xport;
+		pg->xport = NULL;
 	}
+}
 
-	COMMTIMEOUTS timeouts = {0};
-	timeouts.ReadIntervalTimeout = 50;
-	timeouts.ReadTotalTimeoutConstant = 100; 
-	timeouts.ReadTotalTimeoutMultiplier = 10;
-	timeouts.WriteTotalTimeoutConstant = 50;
-	timeouts.WriteTotalTimeoutMultiplier = 10;
-	if (SetCommTimeouts(pg->hComm, &timeouts) == FALSE) {
-		flog("Error in setting time-outs\r\n");
-		CloseHandle(pg->hComm);
-		return 1;
-
-	} else {
-		if (!pg->quiet) { flog("Setting time-outs successful\r\n"); }
-	}
 
-	com_read_status = SetCommMask(pg->hComm, EV_RXCHAR | EV_ERR); // Configure Windows to Monitor the serial device for Character Reception and Errors
-	if (com_read_status == FALSE) {
-		flog("Error in setting CommMask\r\n");
-		CloseHandle(pg->hComm);
-		return 1;
+/*
+ * Push a buffer out to the meter and wait for it to be written.
+ * No pacing delay is added, see WriteRequest() for that.
+ */
+bool WriteRaw( struct glb *g, const char * lpBuf, size_t dwToWrite) {
+	bool fRes;
 
-	} else {
-		if (!pg->quiet) { flog("CommMask successful\r\n"); }
-	}
+	flog_trace("Starting buffer write\n");
+	trace_begin(TRACE_WRITE, dwToWrite);
+	perf_write(&(g->perf));
+	fRes = g->xport->Write(lpBuf, dwToWrite);
+	trace_end(TRACE_WRITE, fRes);
+	flog_trace("buffer write completed\n");
 
-	return 0;
+	return fRes;
 }
 
-
-bool WriteRequest( struct glb *g, char * lpBuf, DWORD dwToWrite) {
-
-	flog("Starting buffer write\n");
-	OVERLAPPED osWrite = {0};
-	DWORD dwWritten;
+bool WriteRequest( struct glb *g, char * lpBuf, size_t dwToWrite) {
 	bool fRes;
 
-	// Create this writes OVERLAPPED structure hEvent.
-	osWrite.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-	if (osWrite.hEvent == NULL)
-		// Error creating overlapped event handle.
-		return FALSE;
-
-	// Issue write.
-	if (!WriteFile(g->hComm, lpBuf, dwToWrite, &dwWritten, &osWrite)) {
-		if (GetLastError() != ERROR_IO_PENDING) { 
-			// WriteFile failed, but it isn't delayed. Report error and abort.
-			fRes = false;
-		} else {
-			// Write is pending.
-			if (!GetOverlappedResult(g->hComm, &osWrite, &dwWritten, TRUE)) {
-				fRes = false;
-			} else {
-				// Write operation completed successfully.
-				fRes = true;
-			}
-		}
-	} else {
-		// WriteFile completed immediately.
-		fRes = true;
-	}
-
-	CloseHandle(osWrite.hEvent);
-	flog("buffer write completed\n");
-	SDL_Delay(10); // 10ms delay
+	fRes = WriteRaw(g, lpBuf, dwToWrite);
+	trace_begin(TRACE_SETTLE);
+	SDL_Delay(10); // 10ms delay, gives the meter time to act on a setting
+	trace_end(TRACE_SETTLE);
 						//
 	return fRes;
 }
 
-int ReadResponse( struct glb *g, char *buffer, size_t buf_limit ) {
-	char chRead = 0;
-	int buf_index = 0;
-	int end_of_frame_received = 0;
-	DWORD dwCommEvent;
-	DWORD dwRead;
-
-	buffer[0] = '\0';
-	buffer[1] = '\0';
-
-	while (!end_of_frame_received) {
-		// Keep trying until we've received an end-of-frame \r
-		//
-		//
-		if (WaitCommEvent(g->hComm, &dwCommEvent, NULL)) {
-			// If we've got something in the comm buffer pipe
-			//
-			//
-			do {
-				if (buf_index >= buf_limit) {
-					buffer[buf_limit -1] = '\0';
-					flog("Buffer limit reached for ReadFile's supplied buffer (%d bytes)\n", buf_limit);
-					return 1;
-				}
-				// If we read 1 char and it's successful
-				//
-				if (ReadFile(g->hComm, &chRead, 1, &dwRead, NULL)) {
+int ReadResponse( struct glb *g, char *buffer, size_t buf_limit, int timeout_ms = -1 ) {
+	int r;
+
+	trace_begin(TRACE_READ, timeout_ms);
+	r = g->xport->ReadFrame(buffer, buf_limit, timeout_ms);
+	trace_end(TRACE_READ, r);
+	if (r == TRANSPORT_OK) {
+		perf_response(&(g->perf), true);
+	} else if (r == TRANSPORT_TIMEOUT) {
+		perf_response(&(g->perf), false);
+		flog_warn("Timed out waiting for response after {}ms\n", timeout_ms);
+	} else if (r == TRANSPORT_ERROR) {
+		return -1; // port gone, no point waiting on it
+	}
 
-					// If we actually did read ONE byte
-					//
-					//
-					if (dwRead == 1) {
-						// Set the byte to the current buffer index
-						//
-						buffer[buf_index] = chRead;
+	return (r == TRANSPORT_OK) ? 0 : 1;
+}
 
-						// If the read char is our terminating char, then 
-						// set the buffer value to 0 (terminate string)
-						// and exit out of loop
-						//
-						//
-						if (chRead == '\n')  {
-							buffer[buf_index] = '\0';
-							end_of_frame_received = 1;
-						}
 
-						buf_index++;
-						// A byte has been read; process it.
-						//
-					}
-				} else {
-					buffer[buf_index] = '\0';
-					// An error occurred in the ReadFile call.
-					break;
-				}
-			} while (dwRead && !end_of_frame_received);
-		} else {
-			flog("Error from WaitCommEvent()\n");
-			// Error in WaitCommEvent
-			break;
-		}
-	}
-	return 0;
+void pipeline_reset( struct scpi_pipeline_s *pl ) {
+	pl->count = 0;
 }
 
+/*
+ * Queue a command on the pipeline.  Pass response as NULL for
+ * commands which don't generate a reply (ie, INIT, SYST:BEEP)
+ *
+ * Returns the request's index, or -1 if the pipeline is full
+ */
+int pipeline_add( struct scpi_pipeline_s *pl, const char *cmd, char *response, size_t response_size, int expect, int timeout_ms ) {
+	struct scpi_req_s *req;
 
-bool auto_detect_port(struct glb *g) {
-	TCHAR szDevices[65535];
-	unsigned long dwChars = QueryDosDevice(NULL, szDevices, 65535);
-	TCHAR *ptr = szDevices;
-
-	while (dwChars) {
-		int port;
+	if (pl->count >= SCPI_PIPELINE_MAX) {
+		flog("Pipeline full, can't add '%s'\n", cmd);
+		return -1;
+	}
 
-		if (swscanf(ptr, L"COM%d", &port) == 1) { // if it finds the format COM#
+	req = &(pl->req[pl->count]);
+	req->cmd = cmd;
+	req->response = response;
+	req->response_size = response_size;
+	req->expect = response ? expect : SCPI_EXPECT_NONE;
+	req->timeout_ms = timeout_ms;
+	req->ok = false;
+	if (response) response[0] = '\0';
 
-			if (port >= 0) {
-				int r = 0;
+	return pl->count++;
+}
 
-				// Try the port...
-				//
-				//
-				g->com_address = port;
-				flog("Attempting detected port: COM%d\r\n",port);
+/*
+ * Strip the trailing \r and any whitespace off a response
+ */
+void scpi_trim( char *s ) {
+	size_t l = strlen(s);
 
-				// Compose the port path ( though I suppose we could use the ptr from above )
-				//
-				//
-				r = enable_coms(g, port); // establish serial communication parameters
-				if (r) {
-					flog("Could not enable comms for port %d, jumping to next device\r\n", port);
-					if(g->hComm) { // prevent small memory leak!
-						CloseHandle(g->hComm);
-					}
-					continue;
+	while (l && (s[l -1] == '\r' || s[l -1] == ' ' || s[l -1] == '\t')) s[--l] = '\0';
+}
 
-				} else {
-					flog("Success enabling comms for port %d. Testing protocol now...\r\n", port);
-				}
+/*
+ * Does the reply look like it belongs to a request of this kind?
+ * A late CONF? answer turning up while we wait on READ? fails this.
+ */
+bool scpi_response_valid( const char *r, int expect ) {
+	const char *p = r;
+	char *e;
 
-				flog("Purging comms on port before testing IDN...\n");
-				purge_coms(g);
-
-				// We did succeed in opening the port, so now let's try
-				// send a query to it
-				//
-				//
-				char response[1024];
-				flog("Querying meter's IDN\n");
-				WriteRequest(g, SCPI_IDN, strlen(SCPI_IDN));
-				ReadResponse(g, response, sizeof(response));
-
-				flog("Response received: %s\n", response);
-				if (strstr(response, "BK Precision,549")) {
-					flog("ID match, this is the right port; returning true for port %d.\n", port);
-					return true; // and our com port is now open
-				} else {
-					flog("No match. Try next port\n");
-				}
-			} // if port > 0
-		} // swscanf()
+	while (*p == ' ') p++;
 
-		// advance the string pointers to the next device
-		//
-		TCHAR *temp_ptr = wcschr(ptr, '\0');
-		dwChars -= (DWORD)((temp_ptr - ptr) / sizeof(TCHAR) + 1);
-		ptr = temp_ptr + 1;
+	switch (expect) {
+		case SCPI_EXPECT_NONE:
+			return true;
 
-	} // while dwChars
+		case SCPI_EXPECT_ANY:
+			return (*p != '\0');
 
-	flog("Was not able to find a matching port in the system. Returning false.\n");
-	return false; // if we made it to the end of the function, auto-detection failed
+		case SCPI_EXPECT_NUMBER:
+		case SCPI_EXPECT_NUMBERS:
+			do {
+				strtod(p, &e);
+				if (e == p) return false;
+				p = e;
+				while (*p == ' ') p++;
+				if (*p == ',' && expect == SCPI_EXPECT_NUMBERS) p++;
+				else break;
+			} while (1);
+			return (*p == '\0');
+
+		case SCPI_EXPECT_CONF:
+			if (*p == '"') p++;
+			return (isalpha((unsigned char)*p));
+	}
 
-} // Autodetect
-  //
-uint32_t str2color( char *str ) {
-						int r, gg, b;
-						sscanf(str, "#%02x%02x%02x", &r, &gg, &b);
-						return ( r | (gg << 8) | (b  << 16) );
+	return false;
 }
 
-
 /*-----------------------------------------------------------------\
-  Date Code:	: 20180127-220307
-  Function Name	: main
+  Function Name	: scpi_resync
   Returns Type	: int
   ----Parameter List
-  1. int argc,
-  2.  char **argv ,
+  1. struct glb *g,
   ------------------
-  Exit Codes	:
+  Exit Codes	: 0 - link back in step, 1 - fell back to purge_coms()
   Side Effects	:
   --------------------------------------------------------------------
 Comments:
+  After a request misses its deadline its reply may still be on the
+  way, and would otherwise be taken as the reply to the next request.
+  We send *OPC? as a fence and throw away everything up to its "1",
+  which leaves the link in step without dropping the port buffers.
 
 --------------------------------------------------------------------
 Changes:
 
 \------------------------------------------------------------------*/
-int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLine, int nCmdShow) {
+int scpi_resync( struct glb *g ) {
+	char buf[SSIZE];
+	uint64_t deadline = SDL_GetTicks64() + g->read_timeout;
+	uint64_t now;
+
+	flog("Resyncing link with *OPC? fence\n");
+	WriteRaw(g, SCPI_OPC, strlen(SCPI_OPC));
+
+	while ((now = SDL_GetTicks64()) < deadline) {
+		int r = ReadResponse(g, buf, sizeof(buf), deadline -now);
+		if (r < 0) {
+			flog("Resync abandoned, port error\n");
+			return -1;
+		}
+		if (r != 0) continue;
+		scpi_trim(buf);
+		if (strcmp(buf, "1") == 0) {
+			flog("Link resynced\n");
+			return 0;
+		}
+		flog("Resync dropping stale response '%s'\n", buf);
+	}
 
-	Confparse conf;
-	struct glb glbs, *g;        // Global structure for passing variables around
-	char meter_conf[SSIZE];
-	int mode_was_changed = 0;
+	flog("Resync fence never came back, purging\n");
+	purge_coms(g);
 
-	char response[SSIZE] = "";
-	char line1[1024] = "";
-	char line2[1024] = "*";
-	char g_value[1024] = "";
-	char g_range[1024] = "";
+	return 1;
+}
 
-	SDL_Surface *surface, *surface_2;
-	SDL_Texture *texture, *texture_2;
-	int meter_mode = 0;
-	bool com_write_status;
-	bool paused = false;
+/*-----------------------------------------------------------------\
+  Function Name	: pipeline_run
+  Returns Type	: int
+  ----Parameter List
+  1. struct glb *g,
+  2. struct scpi_pipeline_s *pl, queued requests
+  ------------------
+  Exit Codes	: number of requests without a valid reply, -1 if
+                 the write failed or the port went away
+  Side Effects	: req[].ok is set for each request
+  --------------------------------------------------------------------
+Comments:
+  Concatenates every queued command in to a single write so the
+  meter sees them back to back, then collects the replies in the
+  same order they were queued.
 
-	char meter_mode_str[20];
-	double meter_range;
-	double meter_precision;
-	double meter_value;
+  Each reply has to turn up by its deadline and look like the kind
+  of reply expected, anything else is dropped as stale.  If any
+  request misses out the link is resynced before returning.
 
-	bool eQuit = false;
-	MSG msg;
-	HWND hwnd;
+--------------------------------------------------------------------
+Changes:
 
-	flog_enable(false);
+\------------------------------------------------------------------*/
+int pipeline_run( struct glb *g, struct scpi_pipeline_s *pl ) {
+	char out[SSIZE];
+	size_t len = 0;
+	uint64_t deadline, now;
+	bool error = false;
+	int failed = 0;
+	int i;
 
-	g = &glbs;
+	for (i = 0; i < pl->count; i++) {
+		size_t cl = strlen(pl->req[i].cmd);
+		if (len +cl >= sizeof(out)) {
+			flog("Pipeline write buffer exhausted at request %d\n", i);
+			break;
+		}
+		memcpy(out +len, pl->req[i].cmd, cl);
+		len += cl;
+	}
 
-	/*
-	 * Initialise the global structure
-	 */
-	init(g);
+	trace_begin(TRACE_PIPELINE, pl->count);
+	if (!WriteRaw(g, out, len)) {
+		flog("Pipeline write failed\n");
+		trace_end(TRACE_PIPELINE);
+		return -1;
+	}
 
-	/*
-	 * Parse our command line parameters
-	 */
-	parse_parameters(g);
+	deadline = SDL_GetTicks64();
+	for (i = 0; i < pl->count && !error; i++) {
+		struct scpi_req_s *req = &(pl->req[i]);
 
-	/*
-	 * Load configuration
-	 */
-	conf.Load("bk5490c.cfg");
+		if (req->response == NULL) {
+			req->ok = true;
+			continue;
+		}
 
-	g->mmdata_enable = conf.ParseBool("mmdata_enable", false);
-	
-	g->debug = conf.ParseBool("debug", false);
-	g->line1_font_filename = conf.ParsePath("line1_font", "RobotoMono-Regular.ttf");
-	g->line1_font_size = conf.ParseInt("line1_font_size", 72);
+		deadline += req->timeout_ms;
+		while ((now = SDL_GetTicks64()) < deadline) {
+			int r = ReadResponse(g, req->response, req->response_size, deadline -now);
+			if (r < 0) error = true;
+			if (r != 0) break;
+			scpi_trim(req->response);
+			if (scpi_response_valid(req->response, req->expect)) {
+				req->ok = true;
+				break;
+			}
+			flog_debug("Dropping stale response '{}' while waiting on '{}'\n", req->response, std::string_view(req->cmd, strcspn(req->cmd, "\r\n")));
+		}
 
-	g->line2_font_filename = conf.ParsePath("line2_font", "RobotoMono-Regular.ttf");
-	g->line2_font_size = conf.ParseInt("line2_font_size", 46);
+		if (!req->ok) {
+			flog_warn("No valid reply to '{}'\n", std::string_view(req->cmd, strcspn(req->cmd, "\r\n")));
+			req->response[0] = '\0';
+			failed++;
+		}
+	}
 
-	g->diode_threshold = conf.ParseDouble("diode_beep_threshold", 0.05);
-	g->diode_beep_enabled = conf.ParseBool("diode_beep_enabled", true);
-	g->cont_threshold = conf.ParseDouble("continuity_beep_threshold", 1.00);
-	g->cont_beep_enabled = conf.ParseBool("continuity_beep_enabled", true);
-	g->system_beep = conf.ParseBool("system_beep", false);
+	if (error) {
+		flog("Pipeline abandoned, port error\n");
+		trace_end(TRACE_PIPELINE, failed);
+		return -1;
+	}
+	if (failed) scpi_resync(g);
+	trace_end(TRACE_PIPELINE, failed);
 
-	uint32_t tc;
-	tc = conf.ParseHex("background_color", 0x000000);
-	g->background_color.r = (tc & 0xff0000) >> 16;
-	g->background_color.g = (tc & 0x00ff00) >> 8;
-	g->background_color.b = tc & 0x0000ff;
-	flog("Background color: parsed 0x%x, converted to %d %d %d\n", tc, g->background_color.r, g->background_color.g, g->background_color.b);
+	return failed;
+}
 
-	tc = conf.ParseHex("line1_font_color", 0x0ac80a);
-	g->line1_color.r = (tc & 0xff0000) >> 16;
-	g->line1_color.g = (tc & 0x00ff00) >> 8;
-	g->line1_color.b = tc & 0x0000ff;
-	flog("Line1 color: parsed 0x%x, converted to %d %d %d\n", tc, g->line1_color.r, g->line1_color.g, g->line1_color.b);
 
-	tc = conf.ParseHex("line2_font_color", 0xc8c80a);
-	g->line2_color.r = (tc & 0xff0000) >> 16;
-	g->line2_color.g = (tc & 0x00ff00) >> 8;
-	g->line2_color.b = tc & 0x0000ff;
-	flog("Line2 color: parsed 0x%x, converted to %d %d %d\n", tc, g->line2_color.r, g->line2_color.g, g->line2_color.b);
+/*
+ * Shared between auto_detect_port() and its probe threads.  The probe
+ * threads may outlive auto_detect_port() if a port hangs past the
+ * deadline, so the last one out ( counted by refs ) frees it.
+ */
+struct detect_s {
+	char ports[TRANSPORT_PORTS_MAX][TRANSPORT_NAME_SIZE];
+	int count;
+	std::atomic<int> refs;
+	std::atomic<int> finished;
+	std::atomic<int> winner;            // index in to ports[], -1 until matched
+	std::atomic<bool> ready;            // winner has filled in xport and idn
+	Transport *xport;                   // winner's open transport
+	char idn[SSIZE];                    // winner's IDN response
+	struct serial_params_s sp;
+};
 
-	//g->debug = true; // forced debug
+struct probe_s {
+	struct detect_s *d;
+	int index;
+};
 
-	if (g->debug) {
-		flog_enable( true );
-		flog_init( "logfile.txt" );
-		flog("BUILD: %s %s\n", __DATE__, __TIME__);
+void detect_release( struct detect_s *d ) {
+	if (d->refs.fetch_sub(1) == 1) delete d;
+}
+
+int probe_thread( void *data ) {
+	struct probe_s *probe = (struct probe_s *)data;
+	struct detect_s *d = probe->d;
+	int index = probe->index;
+	const char *port = d->ports[index];
+	char response[SSIZE] = "";
+	Transport *t;
+
+	delete probe;
+
+	flog("Probing port: %s\r\n", port);
+	t = transport_open_serial(port, &(d->sp));
+	if (t) {
+		t->Purge();
+		t->Write(SCPI_IDN, strlen(SCPI_IDN));
+		t->ReadFrame(response, sizeof(response), DETECT_TIMEOUT);
+		flog("%s responded: '%s'\n", port, response);
+
+		int expected = -1;
+		if (strstr(response, "BK Precision,549") && d->winner.compare_exchange_strong(expected, index)) {
+			flog("ID match on %s\n", port);
+			snprintf(d->idn, sizeof(d->idn), "%s", response);
+			d->xport = t; // ownership goes to auto_detect_port()
+			d->ready.store(true);
+			t = NULL;
+		}
+
+		if (t) {
+			t->Close();
+			delete t;
+		}
 	} else {
-		flog_enable( false );
+		flog("Could not open port %s\r\n", port);
 	}
 
-	/*
+	d->finished.fetch_add(1);
+	detect_release(d);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: detect_ports
+  Returns Type	: bool
+  ----Parameter List
+  1. struct glb *g,
+  2. char ports[][], candidate port names
+  3. int count, number of candidates
+  ------------------
+  Exit Codes	: true if a meter was found, g->xport is then open
+  Side Effects	: sets g->port_name and g->idn
+  --------------------------------------------------------------------
+Comments:
+  Every candidate is probed in its own thread so a dead port only
+  costs us DETECT_TIMEOUT once rather than once per port.  Anything
+  still running at DETECT_DEADLINE is abandoned.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+bool detect_ports( struct glb *g, char ports[][TRANSPORT_NAME_SIZE], int count ) {
+	struct detect_s *d = new detect_s;
+	uint64_t deadline = SDL_GetTicks64() + DETECT_DEADLINE;
+	bool found = false;
+	int i;
+
+	if (count > TRANSPORT_PORTS_MAX) count = TRANSPORT_PORTS_MAX;
+
+	d->count = count;
+	d->refs.store(count +1);
+	d->finished.store(0);
+	d->winner.store(-1);
+	d->ready.store(false);
+	d->xport = NULL;
+	d->idn[0] = '\0';
+	d->sp = g->sp;
+	for (i = 0; i < count; i++) snprintf(d->ports[i], TRANSPORT_NAME_SIZE, "%s", ports[i]);
+
+	for (i = 0; i < count; i++) {
+		struct probe_s *probe = new probe_s;
+		SDL_Thread *th;
+
+		probe->d = d;
+		probe->index = i;
+		th = SDL_CreateThread(probe_thread, "probe", probe);
+		if (th) {
+			SDL_DetachThread(th);
+		} else {
+			flog("Could not create probe thread for %s (%s)\n", ports[i], SDL_GetError());
+			delete probe;
+			d->finished.fetch_add(1);
+			detect_release(d);
+		}
+	}
+
+	/*
+	 * Wait until every probe has reported, or we have a winner and
+	 * the rest have had their chance to close their ports
+	 */
+	while (SDL_GetTicks64() < deadline) {
+		if (d->finished.load() >= count) break;
+		if (d->ready.load()) break;
+		SDL_Delay(10);
+	}
+
+	/*
+	 * Claim the win for ourselves if nobody has, so a straggler that
+	 * answers after we've given up closes its port instead
+	 */
+	int expected = -1;
+	if (!d->winner.compare_exchange_strong(expected, count)) {
+		while (!d->ready.load()) SDL_Delay(1);
+	}
+
+	if (d->ready.load()) {
+		g->xport = d->xport;
+		snprintf(g->port_name, sizeof(g->port_name), "%s", d->ports[d->winner.load()]);
+		snprintf(g->idn, sizeof(g->idn), "%s", d->idn);
+		found = true;
+	} else if (d->finished.load() < count) {
+		flog("Gave up on %d port(s) still probing after %dms\n", count -d->finished.load(), DETECT_DEADLINE);
+	}
+
+	detect_release(d);
+
+	return found;
+}
+
+/*
+ * Same instrument if maker, model and serial number agree, the
+ * firmware field after them is allowed to change
+ */
+bool idn_same_meter( const char *a, const char *b ) {
+	int commas = 0;
+
+	while (*a && *a == *b) {
+		if (*a == ',' && ++commas == 3) return true;
+		a++;
+		b++;
+	}
+
+	return (*a == *b);
+}
+
+bool auto_detect_port(struct glb *g, Confparse *conf) {
+	static char ports[TRANSPORT_PORTS_MAX][TRANSPORT_NAME_SIZE];
+	char last_port[TRANSPORT_NAME_SIZE];
+	char last_idn[sizeof(g->idn)];
+	bool replaced = false;
+	int count, i, n;
+
+	// Try the port the meter was on last time first, on its own
+	//
+	//
+	snprintf(last_port, sizeof(last_port), "%s", conf->ParseStr("last_port", ""));
+	snprintf(last_idn, sizeof(last_idn), "%s", conf->ParseStr("last_idn", ""));
+	if (last_port[0]) {
+		flog("Trying last known port %s first\n", last_port);
+		snprintf(ports[0], TRANSPORT_NAME_SIZE, "%s", last_port);
+		if (detect_ports(g, ports, 1)) {
+			if (!last_idn[0] || idn_same_meter(g->idn, last_idn)) {
+				flog("Meter still on %s\n", g->port_name);
+				return true;
+			}
+
+			// Another 549x has taken its place, go looking for ours
+			//
+			flog("%s now has '%s', was '%s', probing the rest\n", g->port_name, g->idn, last_idn);
+			disable_coms(g);
+			g->idn[0] = '\0';
+			replaced = true;
+		}
+	}
+
+	// ...otherwise everything else in the system, all at once
+	//
+	//
+	count = transport_list_serial_ports(ports, TRANSPORT_PORTS_MAX);
+	for (i = n = 0; i < count; i++) {
+		if (strcmp(ports[i], last_port) == 0) continue;
+		if (n != i) memcpy(ports[n], ports[i], TRANSPORT_NAME_SIZE);
+		n++;
+	}
+
+	flog("Probing %d port(s)\n", n);
+	if (n && detect_ports(g, ports, n)) {
+		flog("Found meter on %s, saving as last_port\n", g->port_name);
+		conf->WriteStr("last_port", g->port_name);
+		conf->WriteStr("last_idn", g->idn);
+		return true;
+	}
+
+	// Ours is nowhere else, so the one on last_port is the meter now
+	// ( swapped out, or a new serial after a repair )
+	//
+	//
+	if (replaced) {
+		snprintf(ports[0], TRANSPORT_NAME_SIZE, "%s", last_port);
+		if (detect_ports(g, ports, 1)) {
+			flog("Taking the meter on %s, saving its IDN as last_idn\n", g->port_name);
+			conf->WriteStr("last_idn", g->idn);
+			return true;
+		}
+	}
+
+	flog("Was not able to find a matching port in the system. Returning false.\n");
+	return false; // if we made it to the end of the function, auto-detection failed
+
+} // Autodetect
+  //
+
+
+/*
+ * Rates to try stepping up to, fastest first
+ */
+static const int baud_rates[] = { 921600, 460800, 230400, 115200, 57600, 38400, 19200, 0 };
+
+/*
+ * Does the meter still answer *IDN? at the port's current settings?
+ */
+bool baud_idn_ok( struct glb *g ) {
+	char response[SSIZE];
+
+	g->xport->Purge();
+	WriteRaw(g, SCPI_IDN, strlen(SCPI_IDN));
+	if (ReadResponse(g, response, sizeof(response), DETECT_TIMEOUT) != 0) return false;
+	scpi_trim(response);
+
+	return (strchr(response, ',') != NULL); // maker,model,serial,firmware
+}
+
+/*
+ * Ask the meter to change rate, the command goes out at whatever
+ * rate the port is at right now
+ */
+void baud_command_send( struct glb *g, int baud ) {
+	char cmd[SSIZE];
+
+	snprintf(cmd, sizeof(cmd), "%s %d\r\n", g->baud_command, baud);
+	flog("Sending baud change: %s", cmd);
+	WriteRaw(g, cmd, strlen(cmd));
+	SDL_Delay(BAUD_SETTLE_TIME);
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: negotiate_baud
+  Returns Type	: int
+  ----Parameter List
+  1. struct glb *g, with g->xport open and talking at g->sp
+  ------------------
+  Exit Codes	: the rate we ended up on, -1 if the meter was lost
+  Side Effects	: g->sp.baud updated to the rate in use
+  --------------------------------------------------------------------
+Comments:
+  Walks down baud_rates[] from g->baud_max, skipping any the port
+  itself won't take.  For the rest it tells the meter to switch,
+  follows it with the port and checks *IDN? still answers.  If it
+  doesn't we tell the meter to go back ( at the new rate, in case
+  it did switch and it's the link that can't keep up ) and return
+  the port to the old rate before trying the next.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int negotiate_baud( struct glb *g ) {
+	struct serial_params_s sp = g->sp;
+	int base = g->sp.baud;
+	int i;
+
+	g->baud_base = base;
+
+	for (i = 0; baud_rates[i]; i++) {
+		int rate = baud_rates[i];
+
+		if (rate > g->baud_max || rate <= base) continue;
+
+		// Make sure our end can do the rate before the meter is
+		// moved to it, or we'd have no way to reach it again
+		//
+		sp.baud = rate;
+		if (g->xport->SetParams(&sp) != 0) {
+			flog("Port can't do %d baud, skipping it\n", rate);
+			sp.baud = base;
+			g->xport->SetParams(&sp);
+			continue;
+		}
+		sp.baud = base;
+		g->xport->SetParams(&sp);
+
+		flog("Trying to step up from %d to %d baud\n", base, rate);
+		baud_command_send(g, rate);
+
+		sp.baud = rate;
+		if (g->xport->SetParams(&sp) == 0 && baud_idn_ok(g)) {
+			flog("Meter answering at %d baud\n", rate);
+			g->sp = sp;
+			return rate;
+		}
+
+		flog("No answer at %d baud, falling back to %d\n", rate, base);
+		baud_command_send(g, base);
+		sp.baud = base;
+		g->xport->SetParams(&sp);
+
+		if (!baud_idn_ok(g)) {
+			flog("Meter not answering at %d baud after fallback either\n", base);
+			return -1;
+		}
+	}
+
+	flog("Staying at %d baud\n", base);
+
+	return base;
+}
+
+/*
+ * Put the meter back to the rate we found it at, so the next
+ * run ( or other software ) can still talk to it
+ */
+void restore_baud( struct glb *g ) {
+	struct serial_params_s sp = g->sp;
+
+	if (g->sp.baud == g->baud_base) return;
+
+	flog("Restoring meter to %d baud\n", g->baud_base);
+	baud_command_send(g, g->baud_base);
+	sp.baud = g->baud_base;
+	if (g->xport->SetParams(&sp) == 0) g->sp = sp;
+}
+
+
+/*-----------------------------------------------------------------\
+  Function Name	: format_sample
+  Returns Type	: int
+  ----Parameter List
+  1. struct glb *g,
+  2. struct meter_sample_s *s, reading to convert
+  3. char *g_value, size_t g_value_size, destination for the value text
+  4. char *g_range, size_t g_range_size, destination for the range text
+  ------------------
+  Exit Codes	:
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Convert the value received from the READ? request in to
+  something we can display on the OSD window
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int format_sample( struct glb *g, struct meter_sample_s *s, char *g_value, size_t g_value_size, char *g_range, size_t g_range_size ) {
+
+	g_value[0] = '\0';
+	g_range[0] = '\0';
+
+	switch (s->mode) {
+		case MMODES_VOLT_AC:
+			if (s->range == 0.1) {
+				snprintf((g_value),g_value_size,"% 06.3f mV AC", s->value *1000);
+				snprintf(g_range, g_range_size, "100mV");
+
+			} else if (s->range == 1.0) {
+				snprintf((g_value),g_value_size,"% 06.5f V AC", s->value);
+				snprintf(g_range, g_range_size, "1V");
+
+			} else if (s->range == 10.0) {
+				snprintf((g_value),g_value_size,"% 06.4f V AC", s->value);
+				snprintf(g_range, g_range_size, "10V");
+
+			} else if (s->range == 100.0) {
+				snprintf((g_value),g_value_size,"% 06.3f V AC", s->value);
+				snprintf(g_range, g_range_size, "100V");
+
+			} else if (s->range == 750.0) {
+				snprintf((g_value),g_value_size,"% 05.2f V AC", s->value);
+				snprintf(g_range, g_range_size, "1000V");
+
+			} else {
+				snprintf((g_value),g_value_size,"% f V AC", s->value);
+				snprintf(g_range, g_range_size, "Unknown");
+			} 
+			break; // VOLTS AC
+
+
+		case MMODES_VOLT_DC:
+			if (s->range == 0.1) {
+				snprintf((g_value),g_value_size,"% 06.3f mV DC", s->value *1000);
+				snprintf(g_range, g_range_size, "100mV");
+
+			} else if (s->range == 1.0) {
+				snprintf((g_value),g_value_size,"% 06.5f V DC", s->value);
+				snprintf(g_range, g_range_size, "1V");
+
+			} else if (s->range == 10.0) {
+				snprintf((g_value),g_value_size,"% 06.4f V DC", s->value);
+				snprintf(g_range, g_range_size, "10V");
+
+			} else if (s->range == 100.0) {
+				snprintf((g_value),g_value_size,"% 06.3f V DC", s->value);
+				snprintf(g_range, g_range_size, "100V");
+
+			} else if (s->range == 1000.0) {
+				snprintf((g_value),g_value_size,"% 06.2f V DC", s->value);
+				snprintf(g_range, g_range_size, "1000V");
+
+			} else {
+				snprintf((g_value),g_value_size,"% f V DC", s->value);
+				snprintf(g_range, g_range_size, "Unknown");
+			} 
+			break; // VOLTS DC
+
+
+		case MMODES_RES:
+			if (strstr(s->raw, "9.90000000E+37")) {
+				snprintf(g_value, g_value_size, "O.L.");
+				snprintf(g_range, g_range_size, "");
+
+			} else  if (s->range == 10.0) {
+				snprintf(g_value, g_value_size,"%6.4f %s", s->value, oo);
+				snprintf(g_range, g_range_size,"10%s",oo);
+
+			} else if (s->range == 100.0) {
+				snprintf(g_value, g_value_size,"%6.3f %s", s->value, oo);
+				snprintf(g_range, g_range_size,"100%s",oo);
+
+			} else if (s->range == 1000.0) {
+				snprintf(g_value, g_value_size,"%6.5f k%s", s->value /1000.0, oo);
+				snprintf(g_range, g_range_size,"1k%s",oo);
+
+			} else if (s->range == 10000.0) {
+				snprintf(g_value, g_value_size,"%6.4f k%s", s->value /1000.0, oo);
+				snprintf(g_range, g_range_size,"10k%s",oo);
+
+			} else if (s->range == 100000.0) {
+				snprintf(g_value, g_value_size,"%6.3f k%s", s->value /1000.0, oo);
+				snprintf(g_range, g_range_size,"100k%s",oo);
+
+			} else if (s->range == 1000000.0) {
+				snprintf(g_value, g_value_size,"%6.5f M%s", s->value /1000000.0, oo);
+				snprintf(g_range, g_range_size,"1M%s",oo);
+
+			} else if (s->range == 10000000.0) {
+				snprintf(g_value, g_value_size,"%6.4f M%s", s->value /1000000.0, oo);
+				snprintf(g_range, g_range_size,"10M%s",oo);
+
+			} else if (s->range == 100000000.0) {
+				snprintf(g_value, g_value_size,"%6.3f M%s", s->value /1000000.0, oo);
+				snprintf(g_range, g_range_size,"100M%s",oo);
+
+			} else {
+				snprintf(g_value, g_value_size,"%f %s", s->value, oo);
+				snprintf(g_range, g_range_size,"10%s",oo);
+
+			}
+			break; // RESISTANCE
+
+
+		case MMODES_CAP:
+			if (strstr(s->conf,"0E-09")) { 
+				snprintf(g_value,g_value_size,"% 6.5f nF", s->value *1E+9 );
+				snprintf(g_range,g_range_size,"1nF"); 
+			}
+
+			else if (strstr(s->conf, "0E-08")){ 
+				snprintf(g_value, g_value_size, "% 06.4f nF", s->value *1E+9);
+				snprintf(g_range,g_range_size,"10nF"); 
+			}
+
+			else if (strstr(s->conf, "0E-07")){ 
+				snprintf(g_value, g_value_size, "% 06.3f nF", s->value *1E+9);
+				snprintf(g_range,g_range_size,"100nF"); 
+			}
+
+			else if (strstr(s->conf, "0E-06")){ 
+				snprintf(g_value, g_value_size, "% 06.5f %sF", s->value *1E+6, uu);
+				snprintf(g_range,g_range_size,"1%sF",uu); 
+			}
+
+			else if (strstr(s->conf, "0E-05")){ 
+				snprintf(g_value, g_value_size, "% 06.4f %sF", s->value *1E+6, uu);
+				snprintf(g_range,g_range_size,"10%sF",uu); 
+			}
+
+			else if (strstr(s->conf, "0E-04")){ 
+				snprintf(g_value, g_value_size, "% 06.3f %sF", s->value *1E+6, uu);
+				snprintf(g_range,g_range_size,"100%sF",uu); 
+			}
+
+			else if (strstr(s->conf, "0E-03")){ 
+				snprintf(g_value, g_value_size, "% 06.5f mF", s->value *1E+3);
+				snprintf(g_range,g_range_size,"1mF"); 
+			}
+
+			else if (strstr(s->conf, "0E-02")){ 
+				snprintf(g_value, g_value_size, "% 06.4f mF", s->value *1E+3);
+				snprintf(g_range,g_range_size,"10mF"); 
+			} 
+
+			else {
+				snprintf(g_value, g_value_size, "uF %f", s->value);
+				snprintf(g_range, g_range_size, "Unknown");
+			}
+			break;
+
+
+		case MMODES_CONT:
+			{ 
+				if (s->value > g->cont_threshold) {
+					snprintf(g_value, g_value_size, "OPEN [%05.1f%s]", s->value, oo);
+				}
+				else {
+					snprintf(g_value, g_value_size, "SHRT [%05.1f%s]", s->value, oo);
+				}
+			}
+			break;
+
+
+		case MMODES_DIOD:
+			{ 
+				if (s->value > 10.0) {
+					snprintf(g_value, g_value_size, "OPEN / OL");
+				} else {
+					snprintf(g_value, g_value_size, "%06.3f V", s->value);
+				}
+			}
+			break;
+
+
+		case MMODES_FREQ:
+			snprintf(g_value, g_value_size, "Hz %f", s->value);
+
+			if (s->range == 0.001) {
+				snprintf(g_value,g_value_size,"% 6.5f Hz", s->value );
+				snprintf(g_range,g_range_size,"10Hz"); 
+			}
+
+			else if (s->range == 0.01) {
+				snprintf(g_value, g_value_size, "% 6.4f Hz", s->value  );
+				snprintf(g_range,g_range_size,"100Hz"); 
+			}
+
+			else if (s->range == 0.1) {
+				snprintf(g_value, g_value_size, "% 6.3f Hz", s->value  );
+				snprintf(g_range,g_range_size,"1kHz"); 
+			}
+
+			else if (s->range == 1) {
+				snprintf(g_value, g_value_size, "% 6.5f kHz", s->value /1000.0 );
+				snprintf(g_range,g_range_size,"10kHz"); 
+			}
+
+			else if (strcmp(s->conf, "10")==0){ 
+				snprintf(g_value, g_value_size, "% 6.4f kHz", s->value / 1000.0 );
+				snprintf(g_range,g_range_size,"100kHz"); 
+			}
+
+			else if (strcmp(s->conf, "100")==0){ 
+				snprintf(g_value, g_value_size, "% 06.3f kHz", s->value /1000.0 );
+				snprintf(g_range,g_range_size,"300kHz"); 
+			}
+
+			else if (strcmp(s->conf, "750")==0){ 
+				snprintf(g_value, g_value_size, "% 06.3f kHz", s->value /1000.0 );
+				snprintf(g_range,g_range_size,"750kHz"); 
+			}
+			break;
+
+
+			/*
+			 *
+			 * Some more items to populate later
+			 *
+			 *
+			 *
+			 case MMODES_VOLT_DCAC:
+			 if (strcmp(g->range,"0.5")==0) snprintf(g_value,g_value_size,"% 07.2f mV DCAC", g->v *1000.0);
+			 else if (strcmp(g->range, "5")==0) snprintf(g_value, g_value_size, "% 07.4f V DCAC", g->v);
+			 else if (strcmp(g->range, "50")==0) snprintf(g_value, g_value_size, "% 07.3f V DCAC", g->v);
+			 else if (strcmp(g->range, "500")==0) snprintf(g_value, g_value_size, "% 07.2f V DCAC", g->v);
+			 else if (strcmp(g->range, "750")==0) snprintf(g_value, g_value_size, "% 07.1f V DCAC", g->v);
+			 break;
+
+			 case MMODES_CURR_AC:
+			 if (strcmp(g->range,"0.0005")==0) snprintf(g_value,g_value_size,"%06.2f %sA AC", g->v, uu);
+			 else if (strcmp(g->range, "0.005")==0) snprintf(g_value, g_value_size, "%06.4f mA AC", g->v);
+			 else if (strcmp(g->range, "0.05")==0) snprintf(g_value, g_value_size, "%06.3f mA AC", g->v);
+			 else if (strcmp(g->range, "0.5")==0) snprintf(g_value, g_value_size, "%06.2f mA AC", g->v);
+			 else if (strcmp(g->range, "5")==0) snprintf(g_value, g_value_size, "%06.1f A AC", g->v);
+			 else if (strcmp(g->range, "10")==0) snprintf(g_value, g_value_size, "%06.3f A AC", g->v);
+			 break;
+
+			 case MMODES_CURR_DC:
+			 if (strcmp(g->range,"0.0005")==0) snprintf(g_value,g_value_size,"%06.2f %sA DC", g->v, uu);
+			 else if (strcmp(g->range, "0.005")==0) snprintf(g_value, g_value_size, "%06.4f mA DC", g->v);
+			 else if (strcmp(g->range, "0.05")==0) snprintf(g_value, g_value_size, "%06.3f mA DC", g->v);
+			 else if (strcmp(g->range, "0.5")==0) snprintf(g_value, g_value_size, "%06.2f mA DC", g->v);
+			 else if (strcmp(g->range, "5")==0) snprintf(g_value, g_value_size, "%06.1f A DC", g->v);
+			 else if (strcmp(g->range, "10")==0) snprintf(g_value, g_value_size, "%06.3f A DC", g->v);
+			 break;
+			 *
+			 * 
+			 *
+			 */
+
+
+	} // SWITCH meter mode - converting value
+
+	return 0;
+}
+
+
+/*
+ * The continuity and diode beeps have to be driven from the
+ * acquisition thread as it's the only one allowed to talk to the meter
+ */
+void beep_check( struct glb *g, struct meter_sample_s *s ) {
+	switch (s->mode) {
+		case MMODES_CONT:
+			if (s->value <= g->cont_threshold && g->cont_beep_enabled) {
+				flog_debug("Resistance below threshold, beeping ({:f} < {:f})\n", s->value, g->cont_threshold);
+				WriteRequest(g, SCPI_BEEP_FORCE, strlen(SCPI_BEEP_FORCE));
+			}
+			break;
+
+		case MMODES_DIOD:
+			if (g->diode_beep_enabled && s->value < g->diode_threshold) {
+				flog_debug("Diode mode below threshold, beeping ({:f} < {:f})\n", s->value, g->diode_threshold);
+				WriteRequest(g, SCPI_BEEP_FORCE, strlen(SCPI_BEEP_FORCE));
+			}
+			break;
+	}
+}
+
+
+int profile_count( int mode ) {
+	int i;
+
+	for (i = 0; i < MPROFILES_MAX; i++) {
+		if (mmodes[mode].profiles[i].label[0] == '\0') break;
+	}
+
+	return i;
+}
+
+/*
+ * Send the settings for one of a function's speed profiles
+ */
+int apply_profile( struct glb *g, int mode, int profile ) {
+	struct mprofile_s *mp;
+	char cmd[SSIZE];
+	const char *scpi = mmodes[mode].scpi;
+
+	if (profile < 0 || profile >= profile_count(mode)) return 1;
+
+	mp = &(mmodes[mode].profiles[profile]);
+	flog("Applying speed profile '%s' to %s\n", mp->label, mmodes[mode].label);
+
+	if (mp->nplc > 0) {
+		snprintf(cmd, sizeof(cmd), "%s:NPLC %g\r\n", scpi, mp->nplc);
+		WriteRequest(g, cmd, strlen(cmd));
+	}
+
+	if (mp->aperture > 0) {
+		snprintf(cmd, sizeof(cmd), "%s:APER %g\r\n", scpi, mp->aperture);
+		WriteRequest(g, cmd, strlen(cmd));
+	}
+
+	if (mp->speed[0]) {
+		snprintf(cmd, sizeof(cmd), "%s:SPEE %s\r\n", scpi, mp->speed);
+		WriteRequest(g, cmd, strlen(cmd));
+	}
+
+	if (mp->autozero >= 0) {
+		snprintf(cmd, sizeof(cmd), "%s:ZERO:AUTO %s\r\n", scpi, mp->autozero ? "ON" : "OFF");
+		WriteRequest(g, cmd, strlen(cmd));
+	}
+
+	return 0;
+}
+
+
+/*
+ * CONF: puts the meter back to one sample per trigger, so this has
+ * to be re-sent after every mode change
+ */
+int arm_streaming( struct glb *g ) {
+	char cmd[SSIZE];
+
+	if (g->stream_samples <= 1) return 0;
+
+	flog("Arming meter for %d samples per trigger\n", g->stream_samples);
+	WriteRequest(g, SCPI_TRIG_IMM, strlen(SCPI_TRIG_IMM));
+	snprintf(cmd, sizeof(cmd), "SAMP:COUN %d\r\n", g->stream_samples);
+	WriteRequest(g, cmd, strlen(cmd));
+
+	return 0;
+}
+
+/*
+ * Break a comma separated block of readings up in place.
+ * Always yields at least one ( possibly empty ) reading.
+ */
+int split_readings( char *block, char **readings, int max ) {
+	int n = 0;
+	char *p = block;
+
+	readings[n++] = p;
+	while (n < max && (p = strchr(p, ','))) {
+		*p = '\0';
+		p++;
+		readings[n++] = p;
+	}
+
+	return n;
+}
+
+/*
+ * Split a CONF? response ( ie, "VOLT +1.00000000E+01,+1.00000000E-05" )
+ * in to the mode string, range and precision
+ */
+int parse_meter_conf( struct meter_conf_s *mc ) {
+	char *p = strchr(mc->raw,',');
+
+	if (!p) {
+		// Diode / continuity etc have no range to report
+		//
+		snprintf(mc->mode_str, sizeof(mc->mode_str), "%s", mc->raw);
+		mc->range = mc->precision = 0.0;
+		return 0;
+	}
+
+	*p = '\0';
+	snprintf(mc->mode_str, sizeof(mc->mode_str), "%s", mc->raw); // copies the DCV / DCI etc
+	*p = ',';
+	p++;
+	mc->range = strtod(p, &p);
+	if (*p == ',') {
+		mc->precision = strtod(p +1, NULL);
+	}
+	flog_debug("Meter configuration conversion: {} => '{}', {:f}, {:f}\n", mc->raw, mc->mode_str, mc->range, mc->precision);
+
+	return 0;
+}
+
+
+/*
+ * Wake the render thread with one of our EVENT_* user events.
+ * Safe to call from any thread.
+ */
+void post_event( struct glb *g, int which, int code ) {
+	SDL_Event ev = {};
+
+	if (g->event_base == (Uint32)-1) return;
+
+	ev.type = g->event_base +which;
+	ev.user.code = code;
+	if (SDL_PushEvent(&ev) < 0) {
+		flog("Could not post event %d (%s)\n", which, SDL_GetError());
+		if (which == EVENT_SAMPLE) g->sample_event_pending.store(false);
+	}
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: acquire_thread
+  Returns Type	: int
+  ----Parameter List
+  1. void *data, struct glb *
+  ------------------
+  Exit Codes	: 0
+  Side Effects	: owns the COM port for as long as it runs
+  --------------------------------------------------------------------
+Comments:
+  All meter I/O happens here.  Each reading is pushed on to
+  g->samples for the render thread to pick up.  Mode changes and
+  pausing are requested from the render thread via g->mode_request
+  and g->acq_paused, g->acq_wake gets us out of a pause.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int acquire_thread( void *data ) {
+	struct glb *g = (struct glb *)data;
+	struct meter_sample_s s;
+	struct scpi_pipeline_s pl;
+	struct meter_conf_s mc = {};
+	char response[STREAM_BUFFER_SIZE] = "";
+	char *readings[STREAM_SAMPLES_MAX];
+	uint64_t now, done;
+	bool refresh_conf;
+	bool link_ok = true;
+	bool link_error;
+	int conf_req, read_req;
+	int i, n;
+	int meter_mode = MMODES_VOLT_DC;
+	int mode_was_changed = 0;
+	bool paused = false;
+
+	flog("Acquisition thread started\n");
+	trace_thread("acquire");
+
+	while (!g->acq_quit.load()) {
+		int req;
+
+		req = g->mode_request.exchange(-1);
+		if (req >= 0 && req < MMODES_MAX) {
+			meter_mode = req;
+			mode_was_changed = 1;
+		}
+
+		if (g->acq_paused.load() != paused) {
+			paused = !paused;
+			if (paused == true) WriteRequest( g, SCPI_LOCAL, strlen(SCPI_LOCAL) );
+			else WriteRequest(g, SCPI_REMOTE, strlen(SCPI_REMOTE));
+			mc.valid = false; // front panel may have been used while we were away
+		}
+
+		if (paused) {
+			SDL_SemWait(g->acq_wake); // until unpaused or told to quit
+			continue;
+		}
+
+		// Step to the next speed profile for the current function.  A
+		// request arriving with a mode change is left for the next
+		// cycle, where it steps the new function's profile.
+		//
+		//
+		if (!mode_was_changed && g->profile_cycle.exchange(0)) {
+			int count = profile_count(meter_mode);
+			if (count) {
+				g->profile_sel[meter_mode] = (g->profile_sel[meter_mode] +1) % count;
+				apply_profile(g, meter_mode, g->profile_sel[meter_mode]);
+				arm_streaming(g);
+				mc.valid = false;
+			}
+		}
+
+		if (mode_was_changed) {
+			mode_was_changed = 0;
+			flog("MODE change request TO meter: '%s'\n", mmodes[meter_mode].query);
+			WriteRequest(g, mmodes[meter_mode].query, strlen(mmodes[meter_mode].query));
+
+			apply_profile(g, meter_mode, g->profile_sel[meter_mode]);
+			arm_streaming(g);
+
+			WriteRequest(g, SCPI_BEEP_FORCE, strlen(SCPI_BEEP_FORCE));
+			mc.valid = false;
+		}
+
+		// Only re-query the configuration if it's stale, otherwise
+		// the fast path is a lone READ? ( or INIT/FETC? when streaming )
+		//
+		//
+		trace_begin(TRACE_CYCLE);
+		now = SDL_GetTicks64();
+		refresh_conf = (!mc.valid || (now - mc.fetched) >= (uint64_t)g->conf_refresh_interval);
+		pipeline_reset(&pl);
+		conf_req = -1;
+		if (refresh_conf) {
+			flog_trace("Requesting configuration...\n");
+			conf_req = pipeline_add(&pl, SCPI_CONF, mc.raw, sizeof(mc.raw), SCPI_EXPECT_CONF, g->read_timeout);
+		}
+		if (g->stream_samples > 1) {
+			flog_trace("Requesting {} sample block...\n", g->stream_samples);
+			pipeline_add(&pl, SCPI_INIT, NULL, 0, SCPI_EXPECT_NONE, 0);
+			read_req = pipeline_add(&pl, SCPI_FETCH, response, sizeof(response), SCPI_EXPECT_NUMBERS,
+					g->read_timeout + g->stream_samples * STREAM_SAMPLE_TIMEOUT);
+		} else {
+			flog_trace("Requesting READ value...\n");
+			read_req = pipeline_add(&pl, SCPI_READ, response, sizeof(response), SCPI_EXPECT_NUMBER, g->read_timeout);
+		}
+		link_error = (pipeline_run(g, &pl) < 0);
+		done = SDL_GetTicks64();
+
+		if (conf_req >= 0) {
+			if (pl.req[conf_req].ok) {
+				mc.fetched = now;
+				mc.valid = (parse_meter_conf(&mc) == 0);
+			} else {
+				mc.valid = false;
+			}
+		}
+
+		if (!pl.req[read_req].ok) {
+			flog_warn("No valid reading this cycle\n");
+			if (link_ok) {
+				link_ok = false;
+				post_event(g, EVENT_SERIAL_ERROR, 0);
+			}
+			trace_end(TRACE_CYCLE);
+
+			// A dead port fails instantly, don't spin on it
+			//
+			if (link_error) SDL_SemWaitTimeout(g->acq_wake, LINK_RETRY_DELAY);
+			continue;
+		}
+		link_ok = true;
+		flog_trace("Response: '{}'\n", response);
+
+		// Split the reply in to readings.  A READ? gives us just the one,
+		// a FETC? gives us a comma separated block of stream_samples, which
+		// we spread evenly across the time the request took.
+		//
+		//
+		n = split_readings(response, readings, STREAM_SAMPLES_MAX);
+		for (i = 0; i < n; i++) {
+			s.ts = now + ((done - now) * (i +1)) / n;
+			s.mode = meter_mode;
+			s.value = strtod(readings[i], NULL);
+			s.range = mc.range;
+			s.precision = mc.precision;
+			snprintf(s.mode_str, sizeof(s.mode_str), "%s", mc.mode_str);
+			snprintf(s.conf, sizeof(s.conf), "%s", mc.raw);
+			snprintf(s.raw, sizeof(s.raw), "%s", readings[i]);
+			if (profile_count(meter_mode)) {
+				snprintf(s.profile, sizeof(s.profile), "%s", mmodes[meter_mode].profiles[g->profile_sel[meter_mode]].label);
+			} else {
+				s.profile[0] = '\0';
+			}
+
+			if (!sampleq_push(g->samples, &s)) {
+				flog_warn("Sample queue full, reading dropped\n");
+			}
+		}
+		flog_trace("Converted {} reading(s), last value: '{: f}'\n", n, s.value);
+
+		// One wake-up for the renderer covers however many samples
+		// land before it gets around to draining the queue
+		//
+		//
+		if (!g->sample_event_pending.exchange(true)) post_event(g, EVENT_SAMPLE, n);
+
+		beep_check(g, &s);
+		trace_end(TRACE_CYCLE, n);
+
+	} // while !acq_quit
+
+	flog("Acquisition thread finished\n");
+
+	return 0;
+}
+
+/*
+ * Act on one of our global hotkeys
+ */
+void hotkey_dispatch( struct glb *g, int id ) {
+	int meter_mode = -1;
+
+	flog("Hotkey detected\n");
+	switch (id) { 
+		case HOTKEY_VOLTS:
+			meter_mode = MMODES_VOLT_DC;
+			break;
+
+		case HOTKEY_VOLTSAC:
+			meter_mode = MMODES_VOLT_AC;
+			break;
+
+		case HOTKEY_AMPS:
+			meter_mode = MMODES_CURR_DC;
+			break;
+
+		case HOTKEY_RESISTANCE:
+			meter_mode = MMODES_RES;
+			break;
+
+		case HOTKEY_CONTINUITY:
+			meter_mode = MMODES_CONT;
+			break;
+
+		case HOTKEY_DIODE:
+			meter_mode = MMODES_DIOD;
+			break;
+
+		case HOTKEY_FREQUENCY:
+			meter_mode = MMODES_FREQ;
+			break;
+
+		case HOTKEY_CAPACITANCE:
+			meter_mode = MMODES_CAP;
+			break;
+
+		case HOTKEY_TEMPERATURE:
+			meter_mode = MMODES_TEMP;
+			break;
+
+		case HOTKEY_PROFILE:
+			g->profile_cycle.store(1);
+			break;
+
+	}  // switch
+
+	if (meter_mode >= 0) g->mode_request.store(meter_mode);
+}
+
+#ifdef _WIN32
+/*
+ * Called by SDL for every message it pumps, RegisterHotKey(NULL, ...)
+ * posts WM_HOTKEY to our thread queue so it comes through here
+ */
+static void SDLCALL hotkey_hook( void *userdata, void *hWnd, unsigned int message, Uint64 wParam, Sint64 lParam ) {
+	struct glb *g = (struct glb *)userdata;
+
+	if (message == WM_HOTKEY) post_event(g, EVENT_HOTKEY, LOWORD(wParam));
+}
+#endif
+
+/*
+ * Start the trend view over for a new span or pane width, filled
+ * back in from the pyramid
+ */
+void trend_reload( struct glb *g ) {
+	trend_free(&(g->trend));
+	if (trend_init(&(g->trend), g->trend_pane.w -2, (uint64_t)g->trend_seconds * 1000) != 0) {
+		g->trend_enable = false;
+		return;
+	}
+
+	if (g->last_ts) trend_rebuild(&(g->trend), &(g->pyramid), g->last_ts, g->pyramid_mode);
+}
+
+/*
+ * Step the trend pane out to the next longer time span, back to the
+ * shortest after the longest.  The view is refilled from the pyramid
+ * so the readings already taken show up straight away.
+ */
+void trend_zoom( struct glb *g ) {
+	static const int spans[] = { 60, 600, 3600, 4 *3600, 12 *3600, 0 };
+	int i;
+
+	for (i = 0; spans[i] && spans[i] <= g->trend_seconds; i++);
+	g->trend_seconds = spans[i] ? spans[i] : spans[0];
+	flog("Trend span now %d seconds\n", g->trend_seconds);
+
+	trend_reload(g);
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: osd_resize
+  Returns Type	: void
+  ----Parameter List
+  1. struct glb *g,
+  2. int w, new window size
+  3. int h,
+  ------------------
+  Exit Codes	:
+  Side Effects	: sets line1_font_want/line2_font_want, re-lays out
+                 the trend pane
+  --------------------------------------------------------------------
+Comments:
+  Both font sizes scale together from the configured ones, by
+  whichever of width or height is tighter so the reading always
+  fits.  The main loop picks up the new atlases from the font cache
+  when they're ready.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+void osd_resize( struct glb *g, int w, int h ) {
+	int text_h = h -(g->trend_enable ? g->trend_height : 0);
+	double scale, sy;
+
+	if (w == g->window_width && h == g->window_height) return;
+	g->window_width = w;
+	g->window_height = h;
+
+	scale = (double)w / (g->text_width > 0 ? g->text_width : 1);
+	sy = (double)text_h / (g->text_height > 0 ? g->text_height : 1);
+	if (sy < scale) scale = sy;
+
+	g->line1_font_want = (int)(g->line1_font_size * scale +0.5);
+	g->line2_font_want = (int)(g->line2_font_size * scale +0.5);
+	if (g->line1_font_want < FONT_SIZE_MIN) g->line1_font_want = FONT_SIZE_MIN;
+	if (g->line1_font_want > FONT_SIZE_MAX) g->line1_font_want = FONT_SIZE_MAX;
+	if (g->line2_font_want < FONT_SIZE_MIN) g->line2_font_want = FONT_SIZE_MIN;
+	if (g->line2_font_want > FONT_SIZE_MAX) g->line2_font_want = FONT_SIZE_MAX;
+
+	if (g->trend_enable) {
+		g->trend_pane = { 10, text_h, w -20, g->trend_height -10 };
+		trend_reload(g);
+	}
+
+	flog("Window now %dx%d, fonts %d/%d px\n", w, h, g->line1_font_want, g->line2_font_want);
+}
+
+/*
+ * Refresh the HUD text from the last perf snapshot
+ */
+void hud_compose( struct glb *g ) {
+	struct perf_snapshot_s *s = &(g->perf_last);
+
+	snprintf(g->hud_text[0], HUD_LINE_SIZE, "samples %.1f/s  dropped %u", s->samples_per_s, g->samples->dropped.load());
+	snprintf(g->hud_text[1], HUD_LINE_SIZE, "rtt %.1f ms  max %.1f  n %u  timeouts %u", s->rtt_avg_ms, s->rtt_max_ms, s->rtt_count, s->timeouts);
+	snprintf(g->hud_text[2], HUD_LINE_SIZE, "render %.2f ms  max %.2f  %.1f fps", s->render_avg_ms, s->render_max_ms, s->fps);
+	snprintf(g->hud_text[3], HUD_LINE_SIZE, "queue %ld  max %ld  damaged %d cells", (long)sampleq_depth(g->samples), (long)s->depth_max,
+			g->line1_cache.damaged +g->line2_cache.damaged);
+}
+
+/*
+ * Performance overlay, top right over a translucent box
+ */
+void hud_draw( struct glb *g, SDL_Renderer *renderer ) {
+	SDL_BlendMode blend;
+	SDL_Rect box;
+	int i, w, width = 0;
+	int lh = g->hud_atlas.height;
+
+	if (!g->hud_atlas.texture) return;
+
+	for (i = 0; i < HUD_LINES; i++) {
+		atlas_text_size(&(g->hud_atlas), g->hud_text[i], &w, NULL);
+		if (w > width) width = w;
+	}
+	box = { g->window_width -width -12, 2, width +8, lh *HUD_LINES +4 };
+
+	SDL_GetRenderDrawBlendMode(renderer, &blend);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 192);
+	SDL_RenderFillRect(renderer, &box);
+	SDL_SetRenderDrawBlendMode(renderer, blend);
+
+	for (i = 0; i < HUD_LINES; i++) {
+		atlas_draw(&(g->hud_atlas), renderer, g->hud_text[i], box.x +4, box.y +2 +(i *lh), g->line2_color);
+	}
+}
+
+uint32_t str2color( char *str ) {
+						int r, gg, b;
+						sscanf(str, "#%02x%02x%02x", &r, &gg, &b);
+						return ( r | (gg << 8) | (b  << 16) );
+}
+
+
+/*-----------------------------------------------------------------\
+  Date Code:	: 20180127-220307
+  Function Name	: main
+  Returns Type	: int
+  ----Parameter List
+  1. int argc,
+  2.  char **argv ,
+  ------------------
+  Exit Codes	:
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Platform neutral body, called from wWinMain() on Windows and
+  main() everywhere else
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int osd_main(int argc, char **argv) {
+
+	Confparse conf;
+	struct glb glbs, *g;        // Global structure for passing variables around
+
+	char response[SSIZE] = "";
+	char line1[1024] = "";
+	char line2[1024] = "*";
+	char g_value[1024] = "";
+	char g_range[1024] = "";
+
+	bool paused = false;
+
+	bool eQuit = false;
+
+	flog_enable(false);
+
+	g = &glbs;
+
+	/*
+	 * Initialise the global structure
+	 */
+	init(g);
+
+	/*
+	 * Parse our command line parameters
+	 */
+	parse_parameters(g, argc, argv);
+	if (!g->trace_convert.empty()) {
+		std::filesystem::path json = g->trace_convert;
+		json += ".json";
+		return trace_export_json(g->trace_convert, json);
+	}
+	if (g->selftest) {
+		int r1 = rxbuf_selftest();
+		int r2 = pyramid_selftest();
+		printf("rxbuf: %s\n", r1 ? "FAILED" : "ok");
+		printf("pyramid: %s\n", r2 ? "FAILED" : "ok");
+		return (r1 || r2) ? 1 : 0;
+	}
+
+	/*
+	 * Load configuration
+	 */
+	conf.Load("bk5490c.cfg");
+
+	g->mmdata_enable = conf.ParseBool("mmdata_enable", false);
+	
+	g->debug = conf.ParseBool("debug", false);
+	g->line1_font_filename = conf.ParsePath("line1_font", FONT_EMBEDDED_REGULAR);
+	g->line1_font_size = conf.ParseInt("line1_font_size", 72);
+
+	g->line2_font_filename = conf.ParsePath("line2_font", FONT_EMBEDDED_REGULAR);
+	g->line2_font_size = conf.ParseInt("line2_font_size", 46);
+
+	/*
+	 * Where to find the meter, the command line takes precedence
+	 */
+	if (!g->port_name[0] && !g->tcp_host[0]) {
+		snprintf(g->port_name, sizeof(g->port_name), "%s", conf.ParseStr("port", ""));
+		snprintf(g->tcp_host, sizeof(g->tcp_host), "%s", conf.ParseStr("tcp_host", ""));
+		g->tcp_port = conf.ParseInt("tcp_port", DEFAULT_TCP_PORT);
+	}
+
+	/*
+	 * Headless, frames go to shared memory instead of a window
+	 */
+	if (!g->headless) g->headless = conf.ParseBool("headless", false);
+	snprintf(g->frame_export_name, sizeof(g->frame_export_name), "%s", conf.ParseStr("frame_export_name", DEFAULT_FRAME_EXPORT_NAME));
+
+	/*
+	 * Serial line settings, again the command line (-s) wins
+	 */
+	if (!g->serial_params[0]) {
+		snprintf(g->serial_params, sizeof(g->serial_params), "%s", conf.ParseStr("serial_params", DEFAULT_SERIAL_PARAMS));
+	}
+	if (serial_params_parse(g->serial_params, &(g->sp)) != 0) {
+		flog("Could not make sense of serial_params '%s', using %s\n", g->serial_params, DEFAULT_SERIAL_PARAMS);
+		serial_params_parse(DEFAULT_SERIAL_PARAMS, &(g->sp));
+	}
+	g->baud_base = g->sp.baud;
+	g->baud_negotiate = conf.ParseBool("baud_negotiate", false);
+	g->baud_max = conf.ParseInt("baud_max", DEFAULT_BAUD_MAX);
+	snprintf(g->baud_command, sizeof(g->baud_command), "%s", conf.ParseStr("baud_command", DEFAULT_BAUD_COMMAND));
+
+	g->diode_threshold = conf.ParseDouble("diode_beep_threshold", 0.05);
+	g->diode_beep_enabled = conf.ParseBool("diode_beep_enabled", true);
+	g->cont_threshold = conf.ParseDouble("continuity_beep_threshold", 1.00);
+	g->cont_beep_enabled = conf.ParseBool("continuity_beep_enabled", true);
+	g->system_beep = conf.ParseBool("system_beep", false);
+	g->conf_refresh_interval = conf.ParseInt("conf_refresh_interval", DEFAULT_CONF_REFRESH_INTERVAL);
+	g->stream_samples = conf.ParseInt("stream_samples", 0);
+	g->read_timeout = conf.ParseInt("read_timeout", DEFAULT_READ_TIMEOUT);
+	if (g->stream_samples > STREAM_SAMPLES_MAX) g->stream_samples = STREAM_SAMPLES_MAX;
+
+	/*
+	 * speed_profile overrides each function's default profile, with
+	 * functions that have fewer profiles using their slowest one
+	 */
+	int speed_profile = conf.ParseInt("speed_profile", -1);
+	if (speed_profile >= 0) {
+		for (int i = 0; i < MMODES_MAX; i++) {
+			int count = profile_count(i);
+			if (count) g->profile_sel[i] = (speed_profile < count) ? speed_profile : count -1;
+		}
+	}
+
+	uint32_t tc;
+	tc = conf.ParseHex("background_color", 0x000000);
+	g->background_color.r = (tc & 0xff0000) >> 16;
+	g->background_color.g = (tc & 0x00ff00) >> 8;
+	g->background_color.b = tc & 0x0000ff;
+	flog("Background color: parsed 0x%x, converted to %d %d %d\n", tc, g->background_color.r, g->background_color.g, g->background_color.b);
+
+	tc = conf.ParseHex("line1_font_color", 0x0ac80a);
+	g->line1_color.r = (tc & 0xff0000) >> 16;
+	g->line1_color.g = (tc & 0x00ff00) >> 8;
+	g->line1_color.b = tc & 0x0000ff;
+	flog("Line1 color: parsed 0x%x, converted to %d %d %d\n", tc, g->line1_color.r, g->line1_color.g, g->line1_color.b);
+
+	tc = conf.ParseHex("line2_font_color", 0xc8c80a);
+	g->line2_color.r = (tc & 0xff0000) >> 16;
+	g->line2_color.g = (tc & 0x00ff00) >> 8;
+	g->line2_color.b = tc & 0x0000ff;
+	flog("Line2 color: parsed 0x%x, converted to %d %d %d\n", tc, g->line2_color.r, g->line2_color.g, g->line2_color.b);
+
+	g->hud_enable = conf.ParseBool("hud_enable", false);
+	g->trace_enable = conf.ParseBool("trace_enable", false);
+	g->trace_filename = conf.ParsePath("trace_file", DEFAULT_TRACE_FILE);
+	g->trace_events = conf.ParseInt("trace_events", TRACE_EVENTS_DEFAULT);
+	g->trend_enable = conf.ParseBool("trend_enable", false);
+	g->trend_height = conf.ParseInt("trend_height", DEFAULT_TREND_HEIGHT);
+	g->trend_seconds = conf.ParseInt("trend_seconds", DEFAULT_TREND_SECONDS);
+	g->pyramid_mb = conf.ParseInt("history_pyramid_mb", DEFAULT_PYRAMID_MB);
+	if (g->pyramid_mb < 1) g->pyramid_mb = 1;
+	if (g->trend_height < 20) g->trend_height = 20;
+	if (g->trend_seconds < 1) g->trend_seconds = 1;
+
+	tc = conf.ParseHex("trend_color", 0x0ac80a);
+	g->trend_color.r = (tc & 0xff0000) >> 16;
+	g->trend_color.g = (tc & 0x00ff00) >> 8;
+	g->trend_color.b = tc & 0x0000ff;
+	flog("Trend color: parsed 0x%x, converted to %d %d %d\n", tc, g->trend_color.r, g->trend_color.g, g->trend_color.b);
+
+	//g->debug = true; // forced debug
+
+	if (g->debug) {
+		int level = flog_level_parse(conf.ParseStr("log_level", "debug"));
+		int rotate_mb = conf.ParseInt("log_rotate_mb", FLOG_ROTATE_BYTES / (1024 *1024));
+		int rotate_hours = conf.ParseInt("log_rotate_hours", FLOG_ROTATE_SECONDS / 3600);
+		int keep = conf.ParseInt("log_keep", FLOG_KEEP);
+
+		if (level >= 0) flog_set_level(level);
+		if (rotate_mb < 0) rotate_mb = 0;
+		if (rotate_hours < 0) rotate_hours = 0;
+		if (keep < 0) keep = 0;
+		flog_rotate((uint64_t)rotate_mb *1024 *1024, rotate_hours *3600, keep);
+		flog_enable( true );
+		flog_init( "logfile.txt" );
+		flog("BUILD: %s %s\n", __DATE__, __TIME__);
+	} else {
+		flog_enable( false );
+	}
+
+	/*
 	 *
 	 * Now do all the Windows GDI stuff
 	 *
 	 */
 	SDL_Event w_event;
 
-	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+	// Headless runs need no display, just the event queue
+	//
+	if (SDL_Init(g->headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) < 0) {
 		flog("SDL Could not initialise (%s)\n", SDL_GetError());
 		exit(1);
 	}
@@ -692,32 +2217,37 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 	g->window_width = g->window_x;
 	g->window_height = g->window_y;
 
+	g->event_base = SDL_RegisterEvents(EVENT_COUNT);
+	if (g->event_base == (Uint32)-1) {
+		flog("SDL could not register our user events\n");
+		exit(1);
+	}
 
-#define HOTKEY_VOLTS 1000
-#define HOTKEY_VOLTSAC 1001
-#define HOTKEY_AMPS 1002
-#define HOTKEY_RESISTANCE 1003
-#define HOTKEY_CONTINUITY 1004
-#define HOTKEY_DIODE 1005
-#define HOTKEY_CAPACITANCE 1006
-#define HOTKEY_FREQUENCY 1007
-#define HOTKEY_TEMPERATURE 1008
-#define HOTKEY_QUIT 1015
 
-	RegisterHotKey(NULL, HOTKEY_VOLTS, MOD_ALT + MOD_SHIFT, 'V'); 
-	RegisterHotKey(NULL, HOTKEY_VOLTSAC, MOD_ALT + MOD_SHIFT, 'W'); 
-	RegisterHotKey(NULL, HOTKEY_AMPS, MOD_ALT + MOD_SHIFT, 'A'); 
-	RegisterHotKey(NULL, HOTKEY_RESISTANCE, MOD_ALT + MOD_SHIFT, 'R'); 
-	RegisterHotKey(NULL, HOTKEY_CONTINUITY, MOD_ALT + MOD_SHIFT, 'C');
-	RegisterHotKey(NULL, HOTKEY_DIODE, MOD_ALT + MOD_SHIFT, 'D');
-	RegisterHotKey(NULL, HOTKEY_CAPACITANCE, MOD_ALT + MOD_SHIFT, 'B'); 
-	RegisterHotKey(NULL, HOTKEY_FREQUENCY, MOD_ALT + MOD_SHIFT, 'H'); 
-	RegisterHotKey(NULL, HOTKEY_TEMPERATURE, MOD_ALT + MOD_SHIFT, 'T'); 
+#ifdef _WIN32
+	if (!g->headless) {
+		RegisterHotKey(NULL, HOTKEY_VOLTS, MOD_ALT + MOD_SHIFT, 'V'); 
+		RegisterHotKey(NULL, HOTKEY_VOLTSAC, MOD_ALT + MOD_SHIFT, 'W'); 
+		RegisterHotKey(NULL, HOTKEY_AMPS, MOD_ALT + MOD_SHIFT, 'A'); 
+		RegisterHotKey(NULL, HOTKEY_RESISTANCE, MOD_ALT + MOD_SHIFT, 'R'); 
+		RegisterHotKey(NULL, HOTKEY_CONTINUITY, MOD_ALT + MOD_SHIFT, 'C');
+		RegisterHotKey(NULL, HOTKEY_DIODE, MOD_ALT + MOD_SHIFT, 'D');
+		RegisterHotKey(NULL, HOTKEY_CAPACITANCE, MOD_ALT + MOD_SHIFT, 'B'); 
+		RegisterHotKey(NULL, HOTKEY_FREQUENCY, MOD_ALT + MOD_SHIFT, 'H'); 
+		RegisterHotKey(NULL, HOTKEY_TEMPERATURE, MOD_ALT + MOD_SHIFT, 'T'); 
+		RegisterHotKey(NULL, HOTKEY_PROFILE, MOD_ALT + MOD_SHIFT, 'S'); 
+
+		// WM_HOTKEY arrives on the thread queue which SDL pumps for us,
+		// the hook turns it in to an SDL event so we can block on one queue
+		//
+		SDL_SetWindowsMessageHook(hotkey_hook, g);
+	}
+#endif
 
 	TTF_Init();
-	g->line1_font = TTF_OpenFont(g->line1_font_filename.string().c_str(), g->line1_font_size);//"RobotoMono-Bold.ttf", g->font_size);
+	g->line1_font = font_open(g->line1_font_filename, g->line1_font_size);
 	if ( !g->line1_font ) { flog("Ooops - something went wrong when trying to create the %d px font", g->line1_font_size ); exit(1); }
-	g->line2_font = TTF_OpenFont(g->line2_font_filename.string().c_str(), g->line2_font_size);//"RobotoMono-Bold.ttf", g->font_size);
+	g->line2_font = font_open(g->line2_font_filename, g->line2_font_size);
 	if ( !g->line2_font ) { flog("Ooops - something went wrong when trying to create the %d px font", g->line2_font_size ); exit(1); }
 
 
@@ -729,12 +2259,73 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 	 */
 	TTF_SizeText(g->line1_font, " 00.00000 mV DCV", &g->window_width, &g->window_height);
 	g->window_height *= 1.85;
+	g->text_width = g->window_width;
+	g->text_height = g->window_height;
+
+	/*
+	 * The trend pane hangs off the bottom of the text
+	 */
+	g->trend_pane = { 10, g->window_height, g->window_width -20, g->trend_height -10 };
+	if (g->trend_enable) g->window_height += g->trend_height;
 
 	if (g->wx_forced) g->window_width = g->wx_forced;
 	if (g->wy_forced) g->window_height = g->wy_forced;
 
-	SDL_Window *window = SDL_CreateWindow("B&K 549XC Meter", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, g->window_width, g->window_height, 0);
-	SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, 0);
+	if (pyramid_init(&(g->pyramid), (size_t)g->pyramid_mb * 1024 * 1024) != 0) exit(1);
+	if (g->trend_enable) {
+		if (trend_init(&(g->trend), g->trend_pane.w -2, (uint64_t)g->trend_seconds * 1000) != 0) exit(1);
+	}
+
+	SDL_Window *window = NULL;
+	SDL_Surface *canvas = NULL;
+	SDL_Renderer *renderer = NULL;
+	struct frame_export_s fexport = {};
+
+	if (g->headless) {
+		/*
+		 * Same layout, drawn by the software renderer in to a plain
+		 * surface which is copied out to shared memory per frame
+		 */
+		canvas = SDL_CreateRGBSurfaceWithFormat(0, g->window_width, g->window_height, 32, SDL_PIXELFORMAT_ARGB8888);
+		if (canvas) renderer = SDL_CreateSoftwareRenderer(canvas);
+		if (frame_export_open(&fexport, g->frame_export_name, g->window_width, g->window_height) != 0) {
+			flog("Could not set up frame export '%s'\n", g->frame_export_name);
+			exit(1);
+		}
+	} else {
+		window = SDL_CreateWindow("B&K 549XC Meter", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, g->window_width, g->window_height, SDL_WINDOW_RESIZABLE);
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_TARGETTEXTURE);
+		if (window) SDL_SetWindowMinimumSize(window, OSD_MIN_WIDTH, OSD_MIN_HEIGHT +(g->trend_enable ? g->trend_height : 0));
+	}
+
+	if (!renderer) {
+		flog("Could not create the %dx%d renderer (%s)\n", g->window_width, g->window_height, SDL_GetError());
+		exit(1);
+	}
+
+	/*
+	 * Rasterise the glyphs for both lines, from here on the text is
+	 * drawn as quads out of these.  Other sizes are done in the
+	 * background as the window is resized.
+	 */
+	TTF_Font *hud_font = font_open(g->line2_font_filename, HUD_FONT_SIZE);
+	if (!hud_font || atlas_build(&(g->hud_atlas), renderer, hud_font) != 0) {
+		flog("Could not build the HUD glyph atlas, HUD disabled\n");
+		g->hud_enable = false;
+	}
+	if (hud_font) TTF_CloseFont(hud_font);
+
+	g->line1_font_want = g->line1_font_size;
+	g->line2_font_want = g->line2_font_size;
+	if (fontcache_init(&(g->fonts), g->line1_font_filename, g->line2_font_filename, g->line1_font_size, g->line2_font_size, renderer,
+				(g->event_base == (Uint32)-1) ? 0 : g->event_base +EVENT_FONTS_READY) != 0) {
+		flog("Ooops - could not build the glyph atlases\n");
+		exit(1);
+	}
+	g->line1_atlas = &(g->fonts.current->line1);
+	g->line2_atlas = &(g->fonts.current->line2);
+	atlas_line_init(&(g->line1_cache));
+	atlas_line_init(&(g->line2_cache));
 
 	/* Select the color for drawing-> It is set to red here. */
 	SDL_SetRenderDrawColor(renderer, g->background_color.r, g->background_color.g, g->background_color.b, 255 );
@@ -746,22 +2337,30 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 	//
 	// Handle the COM Port
 	//
-	if (g->com_address == DEFAULT_COM_PORT) { // no port was specified, so attempt an auto-detect
+	if (g->tcp_host[0]) {
+		flog("Now attempting to connect to: %s:%d....\r\n", g->tcp_host, g->tcp_port);
+		g->xport = transport_open_tcp(g->tcp_host, g->tcp_port);
+		if (!g->xport) {
+			flog("Unable to connect to %s:%d\n", g->tcp_host, g->tcp_port);
+			exit(1);
+		}
+
+	} else if (!g->port_name[0]) { // no port was specified, so attempt an auto-detect
 		flog("Now attempting an auto-detect....\r\n");
-		if(!auto_detect_port(g))  { // returning false means auto-detect failed
+		if(!auto_detect_port(g, &conf))  { // returning false means auto-detect failed
 			flog("Failed to automatically detect COM port. Perhaps try using -p?\r\n");
 			exit(1);
 		}
-		flog("COM%d successfully detected.\r\n",g->com_address); 
+		flog("%s successfully detected.\r\n",g->port_name); 
 
 	} else {
 
 		int r = 0;
-		flog("Now attempting to connect to: %d....\r\n", g->com_address);
-		r = enable_coms(g, g->com_address); // establish serial communication parameters
+		flog("Now attempting to connect to: %s....\r\n", g->port_name);
+		r = enable_coms(g, g->port_name); // establish serial communication parameters
 		flog("Connection attempt result = %d....\r\n", r);
 		if (r != 0) {
-			flog("Unable to connect to port %d due to result=%d\n", g->com_address, r);
+			flog("Unable to connect to port %s due to result=%d\n", g->port_name, r);
 			exit(1);
 		}
 	} 
@@ -771,9 +2370,17 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 
 	flog("Request IDN\n");
 	WriteRequest(g, SCPI_IDN, strlen(SCPI_IDN));
-	ReadResponse(g, response, sizeof(response));
+	ReadResponse(g, response, sizeof(response), g->read_timeout);
 	flog("IDN Response: %s\n", response);
 
+	if (g->baud_negotiate && !g->tcp_host[0]) {
+		flog("Negotiating baud rate, up to %d\n", g->baud_max);
+		if (negotiate_baud(g) < 0) {
+			flog("Lost contact with the meter while negotiating baud rate\n");
+			exit(1);
+		}
+	}
+
 	flog("Setting meter to REMOTE modes\n");
 	WriteRequest(g, SCPI_REMOTE, strlen(SCPI_REMOTE));
 
@@ -785,86 +2392,35 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 		WriteRequest(g, SCPI_BEEP_OFF, strlen(SCPI_BEEP_OFF));
 	}
 
-	flog("Setting Speeds of measurements\n");
-	WriteRequest(g, SCPI_VAC_FAST, strlen(SCPI_VAC_FAST));
-	WriteRequest(g, SCPI_VDC_FAST, strlen(SCPI_VDC_FAST));
-
 	SDL_Delay(250);
 
 
-	mode_was_changed = 1; // sets things up to switch to volts initially.
-	meter_mode = MMODES_VOLT_DC;
-
-	flog("Starting main loop...\n");
-	while (!eQuit) {
-
-		// Clear our C-style strings.  This is overkill 
-		// but sometimes helps avoid odd results
-		//
-		//
-		line1[0] = 0;
-		line2[0] = 0;
-		g_value[0] = 0;
-		g_range[0] = 0;
-
-
-		// Check to see if we have a windows message coming through that
-		// might be our hotkey being pressed
-		//
-		//
-		if (PeekMessage(&msg, hwnd,  WM_HOTKEY, WM_HOTKEY, PM_REMOVE)) {
-			if (msg.message == WM_HOTKEY) { 
-				flog("Hotkey detected\n");
-				switch (LOWORD(msg.wParam)) { 
-					case HOTKEY_VOLTS:
-						meter_mode = MMODES_VOLT_DC;
-						break;
-
-					case HOTKEY_VOLTSAC:
-						meter_mode = MMODES_VOLT_AC;
-						break;
-
-					case HOTKEY_AMPS:
-						meter_mode = MMODES_CURR_DC;
-						break;
-
-					case HOTKEY_RESISTANCE:
-						meter_mode = MMODES_RES;
-						break;
-
-					case HOTKEY_CONTINUITY:
-						meter_mode = MMODES_CONT;
-						break;
-
-					case HOTKEY_DIODE:
-						meter_mode = MMODES_DIOD;
-						break;
-
-					case HOTKEY_FREQUENCY:
-						meter_mode = MMODES_FREQ;
-						break;
-
-					case HOTKEY_CAPACITANCE:
-						meter_mode = MMODES_CAP;
-						break;
-
-					case HOTKEY_TEMPERATURE:
-						meter_mode = MMODES_TEMP;
-						break;
-
-				}  // switch
-
-				mode_was_changed = 1;
-			} // if message == HOTKWEY
-		} // peeking in the message queue 
+	g->mode_request.store(MMODES_VOLT_DC); // sets things up to switch to volts initially.
 
+	if (g->trace_enable && trace_init(g->trace_events) == 0) {
+		flog("Tracing to %s\n", g->trace_filename.string().c_str());
+		trace_thread("render");
+	}
 
+	flog("Starting acquisition thread...\n");
+	SDL_Thread *acq_thread = SDL_CreateThread(acquire_thread, "acquire", g);
+	if (!acq_thread) {
+		flog("Could not create acquisition thread (%s)\n", SDL_GetError());
+		exit(1);
+	}
 
+	flog("Starting main loop...\n");
+	bool redraw = true;
+	while (!eQuit) {
+		struct meter_sample_s sample;
+		bool have_sample = false;
 
-		// Check SDL events - lets us move things
+		// Sleep until something happens, a new sample, a hotkey, a
+		// comms error or window activity, then take everything queued
 		//
 		//
-		while (SDL_PollEvent(&w_event)) {
+		bool have_event = SDL_WaitEventTimeout(&w_event, EVENT_WAIT_TIMEOUT);
+		for (; have_event; have_event = SDL_PollEvent(&w_event)) {
 			switch(w_event.type) {
 
 				case SDL_QUIT: 
@@ -873,419 +2429,291 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 
 				case SDL_KEYDOWN:
 					if (w_event.key.keysym.sym == SDLK_q) {
-						WriteRequest( g, SCPI_LOCAL, strlen(SCPI_LOCAL) );
 						eQuit = true;
 					}
+					if (w_event.key.keysym.sym == SDLK_s) {
+						g->profile_cycle.store(1);
+					}
+					if (w_event.key.keysym.sym == SDLK_z && g->trend_enable) {
+						trend_zoom(g);
+						redraw = true;
+					}
 					if (w_event.key.keysym.sym == SDLK_p) {
 						paused ^= 1;
-						if (paused == true) WriteRequest( g, SCPI_LOCAL, strlen(SCPI_LOCAL) );
-						else WriteRequest(g, SCPI_REMOTE, strlen(SCPI_REMOTE));
+						g->acq_paused.store(paused);
+						SDL_SemPost(g->acq_wake);
+					}
+					if (w_event.key.keysym.sym == SDLK_h) {
+						g->hud_enable = !g->hud_enable;
+						hud_compose(g);
+						redraw = true;
 					}
 					break;
 
-			}
-		} // respond to SDL events
+				case SDL_WINDOWEVENT:
+					switch (w_event.window.event) {
+						case SDL_WINDOWEVENT_SIZE_CHANGED:
+							osd_resize(g, w_event.window.data1, w_event.window.data2);
+							redraw = true;
+							break;
+
+						case SDL_WINDOWEVENT_EXPOSED:
+						case SDL_WINDOWEVENT_SHOWN:
+							redraw = true;
+							break;
+					}
+					break;
 
-		// Change the mode and get the configuration setup
-		//
-		//
-		if (mode_was_changed) {
-			mode_was_changed = 0;
-			flog("MODE change request TO meter: '%s'\n", mmodes[meter_mode].query);
-			com_write_status = WriteRequest(g, mmodes[meter_mode].query, strlen(mmodes[meter_mode].query));
+				case SDL_RENDER_DEVICE_RESET:
+					// Every texture is gone, atlases included
+					//
+					flog("Render device reset, reloading glyph atlases\n");
+					atlas_line_free(&(g->line1_cache));
+					atlas_line_free(&(g->line2_cache));
+					fontcache_lost(&(g->fonts), renderer);
+					atlas_upload(&(g->hud_atlas), renderer);
+					/* fall through */
+
+				case SDL_RENDER_TARGETS_RESET:
+					atlas_line_invalidate(&(g->line1_cache));
+					atlas_line_invalidate(&(g->line2_cache));
+					redraw = true;
+					break;
 
-			if (meter_mode == MMODES_RES) {
-				flog("Setting 2 wire resistance auto-zero to ON\n");
-				com_write_status = WriteRequest(g, SCPI_RES_ZERO_ON, strlen(SCPI_RES_ZERO_ON));
-			}
+				default:
+					if (w_event.type == g->event_base +EVENT_SAMPLE) {
+						g->sample_event_pending.store(false); // before draining, so nothing is missed
 
-			com_write_status = WriteRequest(g, SCPI_BEEP_FORCE, strlen(SCPI_BEEP_FORCE));
+					} else if (w_event.type == g->event_base +EVENT_HOTKEY) {
+						hotkey_dispatch(g, w_event.user.code);
+
+					} else if (w_event.type == g->event_base +EVENT_SERIAL_ERROR) {
+						flog("Meter not responding\n");
+						snprintf(line2, sizeof(line2), "No response from meter");
+					}
+					break;
 
-		} 
+			}
+		} // respond to SDL events
 
-		flog("Requesting current configuration mode...\n");
-		com_write_status = WriteRequest(g, SCPI_CONF, strlen(SCPI_CONF));
-		flog("Getting configuration response...\n");
-		ReadResponse(g, meter_conf, sizeof(meter_conf));
-		flog("Meter configuration: %s\n", meter_conf);
 
-		// Parse the configuration response
+		// Drain everything the acquisition thread has given us, every
+		// reading goes in to the pyramid but we only need to display
+		// the most recent one
 		//
 		//
-		char *p = strchr(meter_conf,',');
-		if (p) {
-			*p = '\0';
-			snprintf(meter_mode_str, sizeof(meter_mode_str), "%s", meter_conf); // copies the DCV / DCI etc
-			*p = ',';
-			p++;
-			meter_range = strtod(p, &p);
-			if (*p == ',') {
-				meter_precision = strtod(p, NULL);
+		size_t depth = sampleq_depth(g->samples);
+		uint32_t drained = 0;
+		trace_begin(TRACE_DRAIN, depth);
+		while (sampleq_pop(g->samples, &sample)) {
+			g->last_ts = sample.ts;
+			if (sample.mode != g->pyramid_mode) {
+				pyramid_reset(&(g->pyramid));
+				g->pyramid_mode = sample.mode;
 			}
+			pyramid_add(&(g->pyramid), sample.ts, sample.value);
+			if (g->trend_enable) trend_add(&(g->trend), sample.ts, sample.value, sample.mode);
+			have_sample = true;
+			drained++;
 		}
-		flog("Meter configuration conversion: %s => '%s', %f, %f\n", meter_conf, meter_mode_str, meter_range, meter_precision);
+		perf_samples(&(g->perf), drained, depth);
+		trace_end(TRACE_DRAIN, drained);
+		if (g->trend_enable && g->trend.dirty) redraw = true;
 
-		// Read a value from the meter
-		//
-		//
-		flog("Requesting READ value...\n");
-		WriteRequest(g, SCPI_READ, strlen(SCPI_READ));
-		flog("Getting response...\n");
-		ReadResponse(g, response, sizeof(response));
-		flog("Response: '%s'\n", response);
+		if (have_sample) {
+			trace_begin(TRACE_FORMAT);
+			format_sample(g, &sample, g_value, sizeof(g_value), g_range, sizeof(g_range));
+			trace_end(TRACE_FORMAT);
 
-		meter_value = strtod(response, NULL);
-		flog("Converted value to: '% f'\n", strtod(response, NULL));
+			// Compose the two lines for the meter OSD output
+			//
+			//
+			flog_trace("Composing text for OSD\n");
+			snprintf(line1, sizeof(line1), "%s", g_value);
+			if (sample.profile[0]) {
+				snprintf(line2, sizeof(line2), "%s, %s, %s", sample.mode_str, g_range, sample.profile);
+			} else {
+				snprintf(line2, sizeof(line2), "%s, %s", sample.mode_str, g_range);
+			}
+			flog_trace("{}\n{}\n", line1, line2);
+		}
 
 
-		// Convert the value received from the READ? request in to
-		// something we can display on the OSD window
+		// Switch to the atlases for the window size once the
+		// font cache has them, until then the old size is drawn
 		//
 		//
-		switch (meter_mode) {
-			case MMODES_VOLT_AC:
-				if (meter_range == 0.1) {
-					snprintf((g_value),sizeof(g_value),"% 06.3f mV AC", meter_value *1000);
-					snprintf(g_range, sizeof(g_range), "100mV");
-
-				} else if (meter_range == 1.0) {
-					snprintf((g_value),sizeof(g_value),"% 06.5f V AC", meter_value);
-					snprintf(g_range, sizeof(g_range), "1V");
-
-				} else if (meter_range == 10.0) {
-					snprintf((g_value),sizeof(g_value),"% 06.4f V AC", meter_value);
-					snprintf(g_range, sizeof(g_range), "10V");
-
-				} else if (meter_range == 100.0) {
-					snprintf((g_value),sizeof(g_value),"% 06.3f V AC", meter_value);
-					snprintf(g_range, sizeof(g_range), "100V");
-
-				} else if (meter_range == 750.0) {
-					snprintf((g_value),sizeof(g_value),"% 05.2f V AC", meter_value);
-					snprintf(g_range, sizeof(g_range), "1000V");
-
-				} else {
-					snprintf((g_value),sizeof(g_value),"% f V AC", meter_value);
-					snprintf(g_range, sizeof(g_range), "Unknown");
-				} 
-				break; // VOLTS AC
-
-
-			case MMODES_VOLT_DC:
-				if (meter_range == 0.1) {
-					snprintf((g_value),sizeof(g_value),"% 06.3f mV DC", meter_value *1000);
-					snprintf(g_range, sizeof(g_range), "100mV");
-
-				} else if (meter_range == 1.0) {
-					snprintf((g_value),sizeof(g_value),"% 06.5f V DC", meter_value);
-					snprintf(g_range, sizeof(g_range), "1V");
-
-				} else if (meter_range == 10.0) {
-					snprintf((g_value),sizeof(g_value),"% 06.4f V DC", meter_value);
-					snprintf(g_range, sizeof(g_range), "10V");
-
-				} else if (meter_range == 100.0) {
-					snprintf((g_value),sizeof(g_value),"% 06.3f V DC", meter_value);
-					snprintf(g_range, sizeof(g_range), "100V");
-
-				} else if (meter_range == 1000.0) {
-					snprintf((g_value),sizeof(g_value),"% 06.2f V DC", meter_value);
-					snprintf(g_range, sizeof(g_range), "1000V");
-
-				} else {
-					snprintf((g_value),sizeof(g_value),"% f V DC", meter_value);
-					snprintf(g_range, sizeof(g_range), "Unknown");
-				} 
-				break; // VOLTS DC
-
-
-			case MMODES_RES:
-				if (strstr(response, "9.90000000E+37")) {
-					snprintf(g_value, sizeof(g_value), "O.L.");
-					snprintf(g_range, sizeof(g_range), "");
-
-				} else  if (meter_range == 10.0) {
-					snprintf(g_value, sizeof(g_value),"%6.4f %s", meter_value, oo);
-					snprintf(g_range, sizeof(g_range),"10%s",oo);
-
-				} else if (meter_range == 100.0) {
-					snprintf(g_value, sizeof(g_value),"%6.3f %s", meter_value, oo);
-					snprintf(g_range, sizeof(g_range),"100%s",oo);
-
-				} else if (meter_range == 1000.0) {
-					snprintf(g_value, sizeof(g_value),"%6.5f k%s", meter_value /1000.0, oo);
-					snprintf(g_range, sizeof(g_range),"1k%s",oo);
-
-				} else if (meter_range == 10000.0) {
-					snprintf(g_value, sizeof(g_value),"%6.4f k%s", meter_value /1000.0, oo);
-					snprintf(g_range, sizeof(g_range),"10k%s",oo);
-
-				} else if (meter_range == 100000.0) {
-					snprintf(g_value, sizeof(g_value),"%6.3f k%s", meter_value /1000.0, oo);
-					snprintf(g_range, sizeof(g_range),"100k%s",oo);
-
-				} else if (meter_range == 1000000.0) {
-					snprintf(g_value, sizeof(g_value),"%6.5f M%s", meter_value /1000000.0, oo);
-					snprintf(g_range, sizeof(g_range),"1M%s",oo);
-
-				} else if (meter_range == 10000000.0) {
-					snprintf(g_value, sizeof(g_value),"%6.4f M%s", meter_value /1000000.0, oo);
-					snprintf(g_range, sizeof(g_range),"10M%s",oo);
-
-				} else if (meter_range == 100000000.0) {
-					snprintf(g_value, sizeof(g_value),"%6.3f M%s", meter_value /1000000.0, oo);
-					snprintf(g_range, sizeof(g_range),"100M%s",oo);
-
-				} else {
-					snprintf(g_value, sizeof(g_value),"%f %s", meter_value, oo);
-					snprintf(g_range, sizeof(g_range),"10%s",oo);
-
-				}
-				break; // RESISTANCE
-
-
-			case MMODES_CAP:
-				if (strstr(meter_conf,"0E-09")) { 
-					snprintf(g_value,sizeof(g_value),"% 6.5f nF", meter_value *1E+9 );
-					snprintf(g_range,sizeof(g_range),"1nF"); 
-				}
-
-				else if (strstr(meter_conf, "0E-08")){ 
-					snprintf(g_value, sizeof(g_value), "% 06.4f nF", meter_value *1E+9);
-					snprintf(g_range,sizeof(g_range),"10nF"); 
-				}
-
-				else if (strstr(meter_conf, "0E-07")){ 
-					snprintf(g_value, sizeof(g_value), "% 06.3f nF", meter_value *1E+9);
-					snprintf(g_range,sizeof(g_range),"100nF"); 
-				}
-
-				else if (strstr(meter_conf, "0E-06")){ 
-					snprintf(g_value, sizeof(g_value), "% 06.5f %sF", meter_value *1E+6, uu);
-					snprintf(g_range,sizeof(g_range),"1%sF",uu); 
-				}
-
-				else if (strstr(meter_conf, "0E-05")){ 
-					snprintf(g_value, sizeof(g_value), "% 06.4f %sF", meter_value *1E+6, uu);
-					snprintf(g_range,sizeof(g_range),"10%sF",uu); 
-				}
-
-				else if (strstr(meter_conf, "0E-04")){ 
-					snprintf(g_value, sizeof(g_value), "% 06.3f %sF", meter_value *1E+6, uu);
-					snprintf(g_range,sizeof(g_range),"100%sF",uu); 
-				}
-
-				else if (strstr(meter_conf, "0E-03")){ 
-					snprintf(g_value, sizeof(g_value), "% 06.5f mF", meter_value *1E+3);
-					snprintf(g_range,sizeof(g_range),"1mF"); 
-				}
-
-				else if (strstr(meter_conf, "0E-02")){ 
-					snprintf(g_value, sizeof(g_value), "% 06.4f mF", meter_value *1E+3);
-					snprintf(g_range,sizeof(g_range),"10mF"); 
-				} 
-
-				else {
-					snprintf(g_value, sizeof(g_value), "uF %f", meter_value);
-					snprintf(g_range, sizeof(g_range), "Unknown");
-				}
-				break;
-
-
-			case MMODES_CONT:
-				{ 
-					if (meter_value > g->cont_threshold) {
-						snprintf(g_value, sizeof(g_value), "OPEN [%05.1f%s]", meter_value, oo);
-					}
-					else {
-						snprintf(g_value, sizeof(g_value), "SHRT [%05.1f%s]", meter_value, oo);
-						if (g->cont_beep_enabled) {
-							flog("Resistance below threshold, beeping (%f < %f)\n", meter_value, g->diode_threshold);
-			//				WriteRequest(g, SCPI_BEEP, strlen(SCPI_BEEP));
-			com_write_status = WriteRequest(g, SCPI_BEEP_FORCE, strlen(SCPI_BEEP_FORCE));
-						}
-					}
-				}
-				break;
-
-
-			case MMODES_DIOD:
-				{ 
-					if (meter_value > 10.0) {
-						snprintf(g_value, sizeof(g_value), "OPEN / OL");
-					} else {
-						snprintf(g_value, sizeof(g_value), "%06.3f V", meter_value);
-					}
-
-					if (g->diode_beep_enabled && meter_value < g->diode_threshold) {
-						flog("Diode mode below threshold, beeping (%f < %f)\n", meter_value, g->diode_threshold);
-					//	WriteRequest(g, SCPI_BEEP, strlen(SCPI_BEEP));
-			com_write_status = WriteRequest(g, SCPI_BEEP_FORCE, strlen(SCPI_BEEP_FORCE));
-					}
-				}
-				break;
-
-
-			case MMODES_FREQ:
-				snprintf(g_value, sizeof(g_value), "Hz %f", meter_value);
-
-				if (meter_range == 0.001) {
-					snprintf(g_value,sizeof(g_value),"% 6.5f Hz", meter_value );
-					snprintf(g_range,sizeof(g_range),"10Hz"); 
-				}
-
-				else if (meter_range == 0.01) {
-					snprintf(g_value, sizeof(g_value), "% 6.4f Hz", meter_value  );
-					snprintf(g_range,sizeof(g_range),"100Hz"); 
-				}
-
-				else if (meter_range == 0.1) {
-					snprintf(g_value, sizeof(g_value), "% 6.3f Hz", meter_value  );
-					snprintf(g_range,sizeof(g_range),"1kHz"); 
-				}
-
-				else if (meter_range == 1) {
-					snprintf(g_value, sizeof(g_value), "% 6.5f kHz", meter_value /1000.0 );
-					snprintf(g_range,sizeof(g_range),"10kHz"); 
-				}
-
-				else if (strcmp(meter_conf, "10")==0){ 
-					snprintf(g_value, sizeof(g_value), "% 6.4f kHz", meter_value / 1000.0 );
-					snprintf(g_range,sizeof(g_range),"100kHz"); 
-				}
-
-				else if (strcmp(meter_conf, "100")==0){ 
-					snprintf(g_value, sizeof(g_value), "% 06.3f kHz", meter_value /1000.0 );
-					snprintf(g_range,sizeof(g_range),"300kHz"); 
-				}
-
-				else if (strcmp(meter_conf, "750")==0){ 
-					snprintf(g_value, sizeof(g_value), "% 06.3f kHz", meter_value /1000.0 );
-					snprintf(g_range,sizeof(g_range),"750kHz"); 
-				}
-				break;
-
+		if (g->fonts.current->size1 != g->line1_font_want || g->fonts.current->size2 != g->line2_font_want) {
+			struct fontcache_entry_s *fe = fontcache_get(&(g->fonts), renderer, g->line1_font_want, g->line2_font_want);
+			if (fe) {
+				g->line1_atlas = &(fe->line1);
+				g->line2_atlas = &(fe->line2);
+				atlas_line_invalidate(&(g->line1_cache));
+				atlas_line_invalidate(&(g->line2_cache));
+				redraw = true;
+			}
+		}
 
-				/*
-				 *
-				 * Some more items to populate later
-				 *
-				 *
-				 *
-				 case MMODES_VOLT_DCAC:
-				 if (strcmp(g->range,"0.5")==0) snprintf(g_value,sizeof(g_value),"% 07.2f mV DCAC", g->v *1000.0);
-				 else if (strcmp(g->range, "5")==0) snprintf(g_value, sizeof(g_value), "% 07.4f V DCAC", g->v);
-				 else if (strcmp(g->range, "50")==0) snprintf(g_value, sizeof(g_value), "% 07.3f V DCAC", g->v);
-				 else if (strcmp(g->range, "500")==0) snprintf(g_value, sizeof(g_value), "% 07.2f V DCAC", g->v);
-				 else if (strcmp(g->range, "750")==0) snprintf(g_value, sizeof(g_value), "% 07.1f V DCAC", g->v);
-				 break;
-
-				 case MMODES_CURR_AC:
-				 if (strcmp(g->range,"0.0005")==0) snprintf(g_value,sizeof(g_value),"%06.2f %sA AC", g->v, uu);
-				 else if (strcmp(g->range, "0.005")==0) snprintf(g_value, sizeof(g_value), "%06.4f mA AC", g->v);
-				 else if (strcmp(g->range, "0.05")==0) snprintf(g_value, sizeof(g_value), "%06.3f mA AC", g->v);
-				 else if (strcmp(g->range, "0.5")==0) snprintf(g_value, sizeof(g_value), "%06.2f mA AC", g->v);
-				 else if (strcmp(g->range, "5")==0) snprintf(g_value, sizeof(g_value), "%06.1f A AC", g->v);
-				 else if (strcmp(g->range, "10")==0) snprintf(g_value, sizeof(g_value), "%06.3f A AC", g->v);
-				 break;
-
-				 case MMODES_CURR_DC:
-				 if (strcmp(g->range,"0.0005")==0) snprintf(g_value,sizeof(g_value),"%06.2f %sA DC", g->v, uu);
-				 else if (strcmp(g->range, "0.005")==0) snprintf(g_value, sizeof(g_value), "%06.4f mA DC", g->v);
-				 else if (strcmp(g->range, "0.05")==0) snprintf(g_value, sizeof(g_value), "%06.3f mA DC", g->v);
-				 else if (strcmp(g->range, "0.5")==0) snprintf(g_value, sizeof(g_value), "%06.2f mA DC", g->v);
-				 else if (strcmp(g->range, "5")==0) snprintf(g_value, sizeof(g_value), "%06.1f A DC", g->v);
-				 else if (strcmp(g->range, "10")==0) snprintf(g_value, sizeof(g_value), "%06.3f A DC", g->v);
-				 break;
-				 *
-				 * 
-				 *
-				 */
-
-
-		} // SWITCH meter mode - converting value
-
-
-		// Compose the two lines for the meter OSD output
+		// Bring the retained line textures up to date, these
+		// only touch the GPU if the text actually changed
 		//
 		//
-		flog("Composing text for OSD\n");
-		snprintf(line1, sizeof(line1), "%s", g_value);
-		snprintf(line2, sizeof(line2), "%s, %s", meter_mode_str, g_range);
-		flog("%s\n%s\n", line1, line2);
+		trace_begin(TRACE_LINES);
+		if (atlas_line_update(&(g->line1_cache), g->line1_atlas, renderer, line1, g->line1_color)) redraw = true;
+		if (atlas_line_update(&(g->line2_cache), g->line2_atlas, renderer, line2, g->line2_color)) redraw = true;
+		trace_end(TRACE_LINES, g->line1_cache.damaged, g->line2_cache.damaged);
 
-
-		// Clear the OSD canvas
+		// Fold the counters in to per second figures, the HUD
+		// only needs redrawing when they roll over
 		//
 		//
-		SDL_SetRenderDrawColor(renderer, g->background_color.r, g->background_color.g, g->background_color.b, SDL_ALPHA_OPAQUE);
+		if (perf_snapshot(&(g->perf), SDL_GetTicks64(), &(g->perf_last)) && g->hud_enable) {
+			hud_compose(g);
+			redraw = true;
+		}
+
+		if (redraw) {
+			uint64_t render_start = perf_now_us();
+			trace_begin(TRACE_DRAW);
+
+			// Clear the OSD canvas
+			//
+			//
+			SDL_SetRenderDrawColor(renderer, g->background_color.r, g->background_color.g, g->background_color.b, SDL_ALPHA_OPAQUE);
 
-		SDL_RenderClear(renderer);
+			SDL_RenderClear(renderer);
 
 
-		// Draw the text on to the canvas
-		//
-		//
-		int texW = 0;
-		int texH = 0;
-		int texW2 = 0;
-		int texH2 = 0;
-		flog("Generating line1 surface->texture");
-		surface = TTF_RenderUTF8_Blended(g->line1_font, line1, g->line1_color);
-		texture = SDL_CreateTextureFromSurface(renderer, surface);
-		SDL_QueryTexture(texture, NULL, NULL, &texW, &texH);
-		SDL_Rect dstrect = { 10, 0, texW, texH };
-		SDL_RenderCopy(renderer, texture, NULL, &dstrect);
-		SDL_DestroyTexture(texture);
-		SDL_FreeSurface(surface);
+			// Composite the two lines
+			//
+			//
+			int texH = g->line1_atlas->height;
+			atlas_line_draw(&(g->line1_cache), renderer, 10, 0);
+			atlas_line_draw(&(g->line2_cache), renderer, 10, texH -(texH /5));
 
-		flog("Generating line2 surface->texture");
-		surface_2 = TTF_RenderUTF8_Blended(g->line2_font, line2, g->line2_color);
-		texture_2 = SDL_CreateTextureFromSurface(renderer, surface_2);
-		SDL_QueryTexture(texture_2, NULL, NULL, &texW2, &texH2);
-		dstrect = { 10, texH -(texH /5), texW2, texH2 };
-		SDL_RenderCopy(renderer, texture_2, NULL, &dstrect);
-		SDL_DestroyTexture(texture_2);
-		SDL_FreeSurface(surface_2);
+			if (g->trend_enable) {
+				trend_draw(&(g->trend), renderer, &(g->trend_pane), g->trend_color, g->line2_color);
+			}
 
+			if (g->hud_enable) hud_draw(g, renderer);
 
-		flog("Presenting composed OSD to display\n");
-		SDL_RenderPresent(renderer);
 
+			trace_end(TRACE_DRAW);
+			flog_trace("Presenting composed OSD to display\n");
+			trace_begin(TRACE_PRESENT);
+			SDL_RenderPresent(renderer);
+			trace_end(TRACE_PRESENT);
+			redraw = false;
 
-		flog("----------------------\n");
+			if (g->headless) {
+				trace_begin(TRACE_EXPORT);
+				SDL_LockSurface(canvas);
+				frame_export_write(&fexport, canvas->pixels, canvas->pitch, SDL_GetTicks64());
+				SDL_UnlockSurface(canvas);
+				trace_end(TRACE_EXPORT);
+			}
+			perf_frame(&(g->perf), perf_now_us() -render_start);
 
-		SDL_Delay(100);
+			flog_trace("----------------------\n");
+		}
 
 	} // main running loop / eQuit
 
+	// Let the acquisition thread finish its current
+	// transaction before we take the port back
+	//
+	//
+	flog("Stopping acquisition thread\n");
+	g->acq_quit.store(true);
+	SDL_SemPost(g->acq_wake);
+	SDL_WaitThread(acq_thread, NULL);
+
 
 	// Before we close down, we set the
-	// meter back in to "local" mode
+	// meter back to the rate we found it at
+	// and in to "local" mode
 	//
 	//
+	restore_baud(g);
 	flog("Switching back to local mode for meter\n");
 	WriteRequest(g, SCPI_LOCAL, strlen(SCPI_LOCAL));
 
 	// Close the COM port
 	//
 	//
-	flog("Disconnecting from COM port\n");
-	CloseHandle(g->hComm); 
+	flog("Disconnecting from %s\n", g->xport->name);
+	disable_coms(g);
 
 
 	// Clean up SDL stuff
 	//
 	//
 	flog("Shutting down SDL Renderer\n");
-	SDL_DestroyWindow(window);
+	atlas_line_free(&(g->line1_cache));
+	atlas_line_free(&(g->line2_cache));
+	fontcache_free(&(g->fonts));
+	if (trace_on.load()) {
+		trace_save(g->trace_filename);
+		trace_free();
+	}
+	atlas_free(&(g->hud_atlas));
+	if (g->trend_enable) trend_free(&(g->trend));
+	pyramid_free(&(g->pyramid));
+	SDL_DestroyRenderer(renderer);
+	if (g->headless) {
+		frame_export_close(&fexport);
+		SDL_FreeSurface(canvas);
+	} else {
+		SDL_DestroyWindow(window);
+	}
 	SDL_Quit();
 
+	delete g->samples;
+	SDL_DestroySemaphore(g->acq_wake);
+
 	flog("Done.\n");
+	flog_shutdown();
 
 
 	return 0;
 
 } 
 
+#ifdef _WIN32
+int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLine, int nCmdShow) {
+	LPWSTR *wargv;
+	char **argv;
+	int argc;
+	int i, r;
+
+	/*
+	 * Convert the wide command line to UTF-8 so the
+	 * parameter parsing can be shared with other platforms
+	 */
+	wargv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	if (NULL == wargv) {
+		return osd_main(0, NULL);
+	}
+
+	argv = (char **)calloc(argc +1, sizeof(char *));
+	for (i = 0; i < argc; i++) {
+		int len = WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, NULL, 0, NULL, NULL);
+		argv[i] = (char *)calloc(1, len +1);
+		WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, argv[i], len, NULL, NULL);
+	}
+	LocalFree(wargv);
+
+	r = osd_main(argc, argv);
+
+	for (i = 0; i < argc; i++) free(argv[i]);
+	free(argv);
+
+	return r;
+}
+#else
+int main(int argc, char **argv) {
+	return osd_main(argc, argv);
+}
+#endif
+
 // END OF CODE
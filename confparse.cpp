@@ -24,12 +24,26 @@ continuity_beep_enabled = true\r\n\
 continuity_beep_threshold = 1.00\r\n\
 \r\n\
 system_beep = false\r\n\
+conf_refresh_interval = 2000\r\n\
 font_size = 72\r\n\
 debug = false\r\n\
 \r\n";
 
 Confparse::~Confparse(void) {
 	if (conf) free(conf);
+	if (store) free(store);
+	if (index) free(index);
+}
+
+static uint32_t confparse_hash( const char *key, size_t len ) {
+	uint32_t h = 2166136261u; // FNV-1a
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= (uint8_t)key[i];
+		h *= 16777619u;
+	}
+
+	return h ? h : 1; // 0 marks an empty slot
 }
 
 int Confparse::SaveDefault(const std::filesystem::path utf8_filename) {
@@ -52,8 +66,10 @@ int Confparse::Load(const std::filesystem::path utf8_filename) {
 	std::ifstream file;
 	file.open(utf8_filename, std::ios::in | std::ios::binary | std::ios::ate);
 	if (!file.is_open()) {
+		if (conf != NULL) free(conf);
 		buffer_size = 0;
 		conf        = NULL;
+		Index();
 		if (nested) return 1; // to prevent infinite recursion, we test the nested flag
 		return (SaveDefault(utf8_filename));
 	}
@@ -72,88 +88,122 @@ int Confparse::Load(const std::filesystem::path utf8_filename) {
 
 	if (file.gcount() != sz) {
 		std::cerr << "Did not read the right number of bytes from configuration file" << std::endl;
+		Index();
 		return 1;
 	}
 
 	nested = false;
+	Index();
 
 	return 0;
 }
 
-char *Confparse::Parse(const char *key) {
-	char *p, *op;
-	char *llimit;
-	int keylen;
-
-	value[0] = '\0';
-
-	if (!conf) return NULL;
-	if (!key) return NULL;
-
-	if (!conf[0]) return NULL;
-	if (!key[0]) return NULL;
-
-	keylen = strlen(key);
-	if (keylen == 0) return NULL;
+/*-----------------------------------------------------------------\
+  Function Name	: Confparse::Index
+  Returns Type	: void
+  ----Parameter List
+  1. void,
+  ------------------
+  Exit Codes	:
+  Side Effects	: rebuilds store and index from conf
+  --------------------------------------------------------------------
+Comments:
+  One pass over the file.  A key is whatever starts a line up to the
+  first space, tab or '=', the value is what follows the '=' and
+  whitespace through to the end of the line.  Lines starting with
+  '#' are comments.  Should a key appear twice the first one wins,
+  same as searching down from the top of the file did.
+
+  store is conf with every CR and LF turned in to a NUL, so each
+  value is already a C string where it sits.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+void Confparse::Index(void) {
+	size_t lines = 1, i;
+	char *p;
+
+	if (store) free(store);
+	if (index) free(index);
+	store = NULL;
+	index = NULL;
+	index_size = 0;
+
+	if (!conf || !buffer_size) return;
+
+	store = (char *)malloc(buffer_size + 1);
+	if (!store) return;
+	memcpy(store, conf, buffer_size + 1);
+	for (i = 0; i < buffer_size; i++) {
+		if ((store[i] == '\r') || (store[i] == '\n')) {
+			store[i] = '\0';
+			lines++;
+		}
+	}
 
-	p = strstr(conf, key);
-	if (p == NULL) {
-		return NULL;
+	index_size = 16;
+	while (index_size < lines * 2) index_size <<= 1;
+	index = (struct confparse_entry_s *)calloc(index_size, sizeof(struct confparse_entry_s));
+	if (!index) {
+		index_size = 0;
+		return;
 	}
 
-	op = p;
+	p = store;
+	while (p < store + buffer_size) {
+		char *line = p, *k = p, *v;
+		size_t keylen, slot;
+		uint32_t h;
 
-	llimit = limit; // - keylen - 2; // allows for up to 'key=x'
+		p += strlen(p) + 1; // next line
 
-	while (p && p < llimit) {
+		while (*k && (*k != ' ') && (*k != '\t') && (*k != '=')) k++;
+		keylen = k - line;
+		if ((keylen == 0) || (line[0] == '#')) continue;
 
-		/*
-		 * Consume the name<whitespace>=<whitespace> trash before we
-		 * get to the actual value.  While this does mean things are
-		 * slightly less strict in the configuration file text it can
-		 * assist in making it easier for people to read it.
-		 */
-		p = p + keylen;
+		v = k;
+		while ((*v == '=') || (*v == ' ') || (*v == '\t')) v++; // get up to the start of the value
 
-		if ((p < llimit) && (!isalnum(*p))) {
+		h    = confparse_hash(line, keylen);
+		slot = h & (index_size - 1);
+		while (index[slot].hash) {
+			struct confparse_entry_s *e = &(index[slot]);
+			if ((e->hash == h) && (e->keylen == keylen) && (memcmp(store + e->key, line, keylen) == 0)) break;
+			slot = (slot + 1) & (index_size - 1);
+		}
+		if (index[slot].hash) continue; // seen it already
 
-			while ((p < llimit) && ((*p == '=') || (*p == ' ') || (*p == '\t'))) p++; // get up to the start of the value;
+		index[slot].hash   = h;
+		index[slot].key    = line - store;
+		index[slot].keylen = keylen;
+		index[slot].value  = v - store;
+	}
+}
 
-			if ((p < llimit) && (p >= conf)) {
+/*
+ * Value for key from the index, NULL if it isn't in the file.  Points
+ * in to store, good until the next Load().
+ */
+char *Confparse::Parse(const char *key) {
+	size_t keylen, slot;
+	uint32_t h;
 
-				/*
-				 * Check that the location of the strstr() return is
-				 * left aligned to the start of the line. This prevents
-				 * us picking up trash name=value pairs among the general
-				 * text within the file
-				 */
-				if ((op == conf) || (*(op - 1) == '\r') || (*(op - 1) == '\n')) {
-					size_t i = 0;
+	if (!index) return NULL;
+	if (!key) return NULL;
 
-					/*
-					 * Search for the end of the data by finding the end of the line
-					 */
-					while ((p < limit) && ((*p != '\0') && (*p != '\n') && (*p != '\r'))) {
-						value[i] = *p;
-						p++;
-						i++;
-						if (i >= CONFPARSE_MAX_VALUE_SIZE) break;
-					}
-					value[i] = '\0';
-					return value;
-				}
-			}
-		}
+	keylen = strlen(key);
+	if (keylen == 0) return NULL;
 
-		// if the previous strstr() was a non-success, then try search again from the next bit
-		if (op < limit) {
-			p = strstr(op + 1, key);
-			if (!p) break;
-			op = p;
-		} else {
-			break;
-		}
+	h    = confparse_hash(key, keylen);
+	slot = h & (index_size - 1);
+	while (index[slot].hash) {
+		struct confparse_entry_s *e = &(index[slot]);
+		if ((e->hash == h) && (e->keylen == keylen) && (memcmp(store + e->key, key, keylen) == 0)) return store + e->value;
+		slot = (slot + 1) & (index_size - 1);
 	}
+
 	return NULL;
 }
 #ifdef _WIN32
@@ -191,7 +241,9 @@ const char *Confparse::ParseStr(const char *key, const char *defaultv) {
 int Confparse::ParseInt(const char *key, int defaultv) {
 	char *p = Parse(key);
 	if (p) {
-		int v = strtol((char *)Parse(key), NULL, 10);
+		int v;
+		errno = 0;
+		v = strtol(p, NULL, 10);
 		if (errno == ERANGE)
 			return defaultv;
 		else
@@ -207,6 +259,7 @@ uint32_t Confparse::ParseHex(const char *key, uint32_t defaultv) {
 		if ((*p == '0') && (*(p + 1) == 'x')) {
 			p += 2;
 		}
+		errno = 0;
 		v = strtoul(p, NULL, 16);
 		if (errno == ERANGE)
 			return defaultv;
@@ -219,7 +272,9 @@ uint32_t Confparse::ParseHex(const char *key, uint32_t defaultv) {
 double Confparse::ParseDouble(const char *key, double defaultv) {
 	char *p = Parse(key);
 	if (p) {
-		double v = strtod(p, NULL);
+		double v;
+		errno = 0;
+		v = strtod(p, NULL);
 		if (errno == ERANGE)
 			return defaultv;
 		else
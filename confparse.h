@@ -1,19 +1,38 @@
 #ifndef __CONFPARSE__
 #define __CONFPARSE__
+#include <stdint.h>
 #include <string>
 #include <filesystem>
 
 #define CONFPARSE_MAX_VALUE_SIZE 10240
+
+/*
+ * One key = value line, offsets in to Confparse::store
+ */
+struct confparse_entry_s {
+	uint32_t hash;          // 0 for an empty slot
+	uint32_t key, keylen;
+	uint32_t value;         // NUL terminated in store
+};
+
 struct Confparse {
 
 	std::filesystem::path filename;
-	char value[CONFPARSE_MAX_VALUE_SIZE];
-	char *conf, *limit;
-	size_t buffer_size;
+	char *conf = NULL, *limit = NULL;
+	size_t buffer_size = 0;
 	bool nested = false;
 
+	/*
+	 * Built once by Load(), every Parse*() is then a hash lookup
+	 * handing back a pointer in to store, valid until the next Load()
+	 */
+	char *store = NULL;     // copy of conf with the line ends NUL'd
+	struct confparse_entry_s *index = NULL;
+	size_t index_size = 0;  // power of two, at most half full
+
 	~Confparse(void);
 	int Load(const std::filesystem::path utf8_filename);
+	void Index(void);
 	int SaveDefault(const std::filesystem::path utf8_filename);
 	char *Parse(const char *key);
 	const char *ParseStr(const char *key, const char *defaultv);
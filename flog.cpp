@@ -1,10 +1,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-
-#include "fmt/core.h"
-#define FMT_HEADER_ONLY
-#include "fmt/format.h"
+#include <atomic>
 
 
 #ifdef _MSC_VER
@@ -21,19 +18,96 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include <stdarg.h>
 #include <string>
 #include <chrono>
+#include <vector>
+#include <algorithm>
+#include <zlib.h>
 //#include "fbvfopen.h"
 #include "flog.h"
 
 std::filesystem::path flogfile;
 static uint64_t flog_its = 0;
 bool flog_enabled = true;
+std::atomic<int> flog_level(FLOG_DEBUG);
+static int flog_level_set = FLOG_DEBUG; // what flog_enable(true) goes back to
+
+/*
+ * The log ring.
+ *
+ * Any thread can log.  A caller claims the next slot by bumping
+ * flog_head, formats straight in to it and publishes it by setting
+ * the slot's seq.  The flusher thread takes slots in order as they're
+ * published and writes them out in batches to the one open file.
+ *
+ * seq == pos        free for the producer claiming pos
+ * seq == pos +1     published, ready for the flusher
+ *
+ * A full ring drops the record and counts it rather than block the
+ * caller, the flusher notes how many went missing.
+ */
+struct flog_slot_s {
+	std::atomic<size_t> seq;
+	size_t pos;             // claimed at, for flog_commit()
+	uint64_t ts;            // ms since flog_init()
+	uint16_t len;
+	bool raw;               // flog_raw(), no timestamp
+	char text[FLOG_SLOT_TEXT];
+};
+
+static struct flog_slot_s flog_ring[FLOG_SLOTS];
+static std::atomic<size_t> flog_head(0);
+static size_t flog_tail = 0; // flusher only
+static std::atomic<uint32_t> flog_dropped(0);
+static std::atomic<bool> flog_running(false);
+static std::atomic<bool> flog_quit(false);
+static SDL_Thread *flog_thread = NULL;
+static SDL_sem *flog_wake = NULL;
+static FILE *flog_fp = NULL;
+
+/*
+ * Rotation.  The flusher closes the file off once it's big or old
+ * enough, renames it aside and hands it to the compressor thread,
+ * so neither the callers nor the flusher ever wait on zlib.
+ */
+static uint64_t flog_rotate_bytes = FLOG_ROTATE_BYTES;
+static int flog_rotate_seconds = FLOG_ROTATE_SECONDS;
+static int flog_keep = FLOG_KEEP;
+static uint64_t flog_written = 0;       // bytes in the current file
+static uint64_t flog_opened = 0;        // flog_millis() when it was started
+
+static SDL_Thread *flog_gz_thread = NULL;
+static SDL_sem *flog_gz_wake = NULL;
+static SDL_mutex *flog_gz_lock = NULL;
+static std::filesystem::path flog_gz_queue[FLOG_GZ_QUEUE];
+static int flog_gz_count = 0;
+static std::atomic<bool> flog_gz_quit(false);
 
 void flog_enable( bool enable ) {
 	flog_enabled = enable;
+	flog_level.store(enable ? flog_level_set : FLOG_OFF);
+}
+
+void flog_set_level( int level ) {
+	flog_level_set = level;
+	if (flog_enabled) flog_level.store(level);
+}
+
+/*
+ * "trace", "debug", "info", "warn" or "error", -1 if it's none of them
+ */
+int flog_level_parse( const char *name ) {
+	static const char *names[] = { "trace", "debug", "info", "warn", "error", NULL };
+
+	for (int i = 0; names[i]; i++) {
+		if (SDL_strcasecmp(name, names[i]) == 0) return FLOG_TRACE +i;
+	}
+
+	return -1;
 }
 
 uint64_t flog_millis()
@@ -41,7 +115,7 @@ uint64_t flog_millis()
 	uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
 			std::chrono::high_resolution_clock::now().time_since_epoch())
 		.count();
-	return ms; 
+	return ms;
 }
 
 
@@ -49,18 +123,488 @@ std::filesystem::path flog_flogfilename( void ) {
 	return flogfile;
 }
 
+static FILE *flog_fopen( const std::filesystem::path &logfile, bool append ) {
+#ifdef _WIN32
+	return _wfopen(logfile.c_str(), append ? L"ab" : L"wb");
+#else
+	return fopen(logfile.c_str(), append ? "ab" : "wb");
+#endif
+}
+
+/*
+ * Write out everything published so far, returns the records taken
+ */
+static int flog_drain( void ) {
+	static char batch[FLOG_BATCH_SIZE];
+	size_t used = 0;
+	uint32_t dropped;
+	int n = 0;
+
+	while (1) {
+		struct flog_slot_s *s = &(flog_ring[flog_tail & (FLOG_SLOTS -1)]);
+		char stamp[32];
+		int sl = 0;
+
+		if (s->seq.load(std::memory_order_acquire) != flog_tail +1) break;
+
+		if (!s->raw) sl = snprintf(stamp, sizeof(stamp), "%06llu ", (unsigned long long)s->ts);
+		if (used +sl +s->len > sizeof(batch)) {
+			fwrite(batch, 1, used, flog_fp);
+			flog_written += used;
+			used = 0;
+		}
+		memcpy(batch +used, stamp, sl);
+		used += sl;
+		memcpy(batch +used, s->text, s->len);
+		used += s->len;
+
+		s->seq.store(flog_tail +FLOG_SLOTS, std::memory_order_release);
+		flog_tail++;
+		n++;
+	}
+
+	dropped = flog_dropped.exchange(0, std::memory_order_relaxed);
+	if (dropped && used +64 <= sizeof(batch)) {
+		used += snprintf(batch +used, 64, "[%u log records dropped]\n", dropped);
+	}
+
+	if (used) {
+		fwrite(batch, 1, used, flog_fp);
+		fflush(flog_fp);
+		flog_written += used;
+	}
+
+	return n;
+}
+
+/*
+ * Where the current file goes when it's rotated out, ie
+ * logfile.txt becomes logfile-20240131-235959.txt
+ */
+static std::filesystem::path flog_segment_name( void ) {
+	std::filesystem::path dir = flogfile.parent_path();
+	std::filesystem::path name;
+	char stamp[32];
+	time_t now = time(NULL);
+	struct tm *tm = localtime(&now);
+	int i;
+
+	strftime(stamp, sizeof(stamp), "-%Y%m%d-%H%M%S", tm);
+	for (i = 0; ; i++) {
+		std::error_code ec;
+		std::string leaf = flogfile.stem().string() +stamp;
+
+		if (i) leaf += "." +std::to_string(i);
+		leaf += flogfile.extension().string();
+		name = dir / leaf;
+		if (!std::filesystem::exists(name, ec) && !std::filesystem::exists(name.string() +".gz", ec)) break;
+	}
+
+	return name;
+}
+
+static void flog_gz_push( const std::filesystem::path &segment ) {
+	bool queued = false;
+
+	if (!flog_gz_lock) return;
+
+	SDL_LockMutex(flog_gz_lock);
+	if (flog_gz_count < FLOG_GZ_QUEUE) {
+		flog_gz_queue[flog_gz_count++] = segment;
+		queued = true;
+	}
+	SDL_UnlockMutex(flog_gz_lock);
+
+	// A full queue leaves the segment as it is, flog_archive_scan()
+	// picks it up next time
+	//
+	if (queued) SDL_SemPost(flog_gz_wake);
+}
+
+/*
+ * Move the file aside and start a new one, flusher thread only
+ * once it's running
+ */
+static void flog_rotate_now( void ) {
+	std::filesystem::path segment = flog_segment_name();
+	std::error_code ec;
+
+	fclose(flog_fp);
+	std::filesystem::rename(flogfile, segment, ec);
+	if (!ec) flog_gz_push(segment);
+
+	flog_fp = flog_fopen(flogfile, ec ? true : false);
+	flog_written = 0;
+	flog_opened = flog_millis();
+}
+
+static bool flog_rotate_due( void ) {
+	if (!flog_written) return false;
+	if (flog_rotate_bytes && flog_written >= flog_rotate_bytes) return true;
+	if (flog_rotate_seconds && (flog_millis() -flog_opened) >= (uint64_t)flog_rotate_seconds * 1000) return true;
+
+	return false;
+}
+
+static int flog_flusher( void *arg ) {
+	while (!flog_quit.load()) {
+		SDL_SemWaitTimeout(flog_wake, FLOG_FLUSH_INTERVAL);
+		flog_drain();
+		if (flog_rotate_due()) {
+			flog_rotate_now();
+			if (!flog_fp) break; // can't log anywhere now
+		}
+	}
+	if (flog_fp) flog_drain();
+
+	return 0;
+}
+
+/*
+ * gzip one rotated segment to segment.gz and remove it
+ */
+static int flog_gzip( const std::filesystem::path &segment ) {
+	static char buf[FLOG_BATCH_SIZE];
+	std::filesystem::path target = segment.string() +".gz";
+	std::error_code ec;
+	FILE *in;
+	gzFile out;
+	size_t n;
+	int r = 0;
+
+#ifdef _WIN32
+	in = _wfopen(segment.c_str(), L"rb");
+	out = in ? gzopen_w(target.c_str(), "wb") : NULL;
+#else
+	in = fopen(segment.c_str(), "rb");
+	out = in ? gzopen(target.c_str(), "wb") : NULL;
+#endif
+	if (!out) {
+		if (in) fclose(in);
+		return 1;
+	}
+
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (gzwrite(out, buf, (unsigned)n) != (int)n) { r = 1; break; }
+	}
+	if (ferror(in)) r = 1;
+	fclose(in);
+	if (gzclose(out) != Z_OK) r = 1;
+
+	// Only lose the original once the archive is known good
+	//
+	if (r == 0) std::filesystem::remove(segment, ec);
+	else std::filesystem::remove(target, ec);
+
+	return r;
+}
+
+/*
+ * Drop the oldest archives past flog_keep
+ */
+static void flog_prune( void ) {
+	std::filesystem::path dir = flogfile.parent_path();
+	std::string prefix = flogfile.stem().string() +"-";
+	std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> archives;
+	std::error_code ec;
+
+	if (!flog_keep) return;
+	if (dir.empty()) dir = ".";
+
+	for (auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+		std::string leaf = entry.path().filename().string();
+
+		if (leaf.compare(0, prefix.size(), prefix) != 0) continue;
+		if (entry.path().extension() != ".gz") continue;
+		archives.push_back({ entry.last_write_time(ec), entry.path() });
+	}
+	if ((int)archives.size() <= flog_keep) return;
+
+	// Oldest first.  Not by name, two rotations in the same second
+	// get a .1 that sorts ahead of the one before it.
+	//
+	std::sort(archives.begin(), archives.end());
+	for (size_t i = 0; i < archives.size() -flog_keep; i++) std::filesystem::remove(archives[i].second, ec);
+}
+
+static int flog_compressor( void *arg ) {
+	while (1) {
+		std::filesystem::path segment;
+
+		SDL_SemWait(flog_gz_wake);
+
+		SDL_LockMutex(flog_gz_lock);
+		if (flog_gz_count) {
+			segment = flog_gz_queue[0];
+			for (int i = 1; i < flog_gz_count; i++) flog_gz_queue[i -1] = flog_gz_queue[i];
+			flog_gz_count--;
+		}
+		SDL_UnlockMutex(flog_gz_lock);
+
+		if (!segment.empty()) {
+			flog_gzip(segment);
+			flog_prune();
+		} else if (flog_gz_quit.load()) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Archive whatever the last run left behind, the old log itself and
+ * any segments that didn't get compressed before it exited
+ */
+static void flog_archive_scan( void ) {
+	std::filesystem::path dir = flogfile.parent_path();
+	std::string prefix = flogfile.stem().string() +"-";
+	std::string ext = flogfile.extension().string();
+	std::error_code ec;
+
+	if (dir.empty()) dir = ".";
+
+	for (auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+		std::string leaf = entry.path().filename().string();
+
+		if (leaf.compare(0, prefix.size(), prefix) != 0) continue;
+		if (entry.path().extension() != ext) continue;
+		flog_gz_push(entry.path());
+	}
+
+	if (std::filesystem::file_size(flogfile, ec) > 0 && !ec) {
+		std::filesystem::path segment = flog_segment_name();
+		std::filesystem::rename(flogfile, segment, ec);
+		if (!ec) flog_gz_push(segment);
+	}
+}
+
+/*
+ * The compressor finishes whatever was queued before it goes
+ */
+static void flog_gz_stop( void ) {
+	if (flog_gz_thread) {
+		flog_gz_quit.store(true);
+		SDL_SemPost(flog_gz_wake);
+		SDL_WaitThread(flog_gz_thread, NULL);
+		flog_gz_thread = NULL;
+	}
+	if (flog_gz_wake) SDL_DestroySemaphore(flog_gz_wake);
+	if (flog_gz_lock) SDL_DestroyMutex(flog_gz_lock);
+	flog_gz_wake = NULL;
+	flog_gz_lock = NULL;
+	flog_gz_count = 0;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: flog_claim
+  Returns Type	: struct flog_slot_s *
+  ----Parameter List
+  1. size_t *pos, set to the slot's position, for flog_publish()
+  ------------------
+  Exit Codes	: the slot, or NULL if the ring is full
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Lock free, producers only contend on the compare-exchange of
+  flog_head.  Every half ring's worth of records the flusher is
+  woken early rather than left to its next interval.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+static struct flog_slot_s *flog_claim( size_t *pos ) {
+	size_t p = flog_head.load(std::memory_order_relaxed);
+
+	while (1) {
+		struct flog_slot_s *s = &(flog_ring[p & (FLOG_SLOTS -1)]);
+		size_t seq = s->seq.load(std::memory_order_acquire);
+		intptr_t dif = (intptr_t)seq -(intptr_t)p;
+
+		if (dif == 0) {
+			if (flog_head.compare_exchange_weak(p, p +1, std::memory_order_relaxed)) {
+				*pos = p;
+				if ((p & (FLOG_SLOTS /2 -1)) == 0) SDL_SemPost(flog_wake);
+				return s;
+			}
+		} else if (dif < 0) {
+			flog_dropped.fetch_add(1, std::memory_order_relaxed);
+			return NULL;
+		} else {
+			p = flog_head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+static void flog_publish( struct flog_slot_s *s, size_t pos ) {
+	s->seq.store(pos +1, std::memory_order_release);
+}
+
+/*
+ * flog_fmt()'s way in, a timestamped slot to format in to
+ */
+struct flog_slot_s *flog_reserve( char **text, size_t *cap ) {
+	struct flog_slot_s *s;
+	size_t pos;
+
+	if (!flog_running.load(std::memory_order_relaxed)) return NULL;
+
+	s = flog_claim(&pos);
+	if (!s) return NULL;
+
+	s->pos = pos;
+	s->ts = flog_millis() -flog_its;
+	s->raw = false;
+	*text = s->text;
+	*cap = FLOG_SLOT_TEXT;
+
+	return s;
+}
+
+void flog_commit( struct flog_slot_s *s, size_t len, bool truncated ) {
+	if (truncated && len) s->text[len -1] = '\n';
+	s->len = len;
+	flog_publish(s, s->pos);
+}
+
+/*
+ * Format in to a fresh slot, over-long messages are cut short
+ * but keep their line ending
+ */
+static int flog_record( bool raw, const char *format, va_list args ) {
+	struct flog_slot_s *s;
+	size_t pos;
+	int l;
+
+	if (!flog_running.load(std::memory_order_relaxed)) return 0;
+
+	s = flog_claim(&pos);
+	if (!s) return 0;
+
+	s->ts = raw ? 0 : flog_millis() -flog_its;
+	s->raw = raw;
+	l = vsnprintf(s->text, FLOG_SLOT_TEXT, format, args);
+	if (l < 0) l = 0;
+	if (l >= FLOG_SLOT_TEXT) {
+		l = FLOG_SLOT_TEXT -1;
+		if (format[strlen(format) -1] == '\n') s->text[l -1] = '\n';
+	}
+	s->len = l;
+	flog_publish(s, pos);
+
+	return 0;
+}
+
+/*
+ * Stop the flusher once everything queued is written out.
+ * Registered with atexit() so exit() paths keep their last words.
+ */
+void flog_shutdown( void ) {
+	if (!flog_running.exchange(false)) return;
+
+	flog_quit.store(true);
+	SDL_SemPost(flog_wake);
+	SDL_WaitThread(flog_thread, NULL);
+	flog_thread = NULL;
+
+	SDL_DestroySemaphore(flog_wake);
+	flog_wake = NULL;
+	if (flog_fp) fclose(flog_fp);
+	flog_fp = NULL;
+
+	flog_gz_stop();
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: flog_rotate
+  Returns Type	: void
+  ----Parameter List
+  1. uint64_t max_bytes, rotate once the file reaches this, 0 for never
+  2. int max_seconds, or once it's this old, 0 for never
+  3. int keep, compressed logs to keep, 0 keeps them all
+  ------------------
+  Exit Codes	:
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Takes effect from the next flog_init().  Rotated logs are renamed
+  to logfile-YYYYmmdd-HHMMSS.txt and gzipped by a thread of their
+  own, the flusher only pays for a close, a rename and an open.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+void flog_rotate( uint64_t max_bytes, int max_seconds, int keep ) {
+	flog_rotate_bytes = max_bytes;
+	flog_rotate_seconds = max_seconds;
+	flog_keep = keep;
+}
+
 int flog_init( std::filesystem::path logfile ) {
+	static bool registered = false;
 
-	std::ofstream f;
+	flog_shutdown();
 
 	flogfile = logfile;
 	flog_its = flog_millis();
-	f.open(flogfile, std::ios::binary);
-	if (f.is_open()) f.close();
+
+	// Last run's log is archived rather than truncated
+	//
+	flog_gz_count = 0;
+	flog_gz_quit.store(false);
+	flog_gz_lock = SDL_CreateMutex();
+	flog_gz_wake = SDL_CreateSemaphore(0);
+	if (flog_gz_lock && flog_gz_wake) {
+		flog_archive_scan();
+		flog_gz_thread = SDL_CreateThread(flog_compressor, "floggz", NULL);
+	}
+	if (!flog_gz_thread) {
+		// Rotation still happens, the segments just stay uncompressed
+		// until a later run picks them up
+		//
+		flog_gz_stop();
+	}
+
+	flog_fp = flog_fopen(flogfile, false);
+	if (!flog_fp) {
+		flog_gz_stop();
+		return 1;
+	}
+	flog_written = 0;
+	flog_opened = flog_its;
+
+	for (size_t i = 0; i < FLOG_SLOTS; i++) flog_ring[i].seq.store(i, std::memory_order_relaxed);
+	flog_head.store(0);
+	flog_tail = 0;
+	flog_dropped.store(0);
+	flog_quit.store(false);
+
+	flog_wake = SDL_CreateSemaphore(0);
+	if (flog_wake) flog_thread = SDL_CreateThread(flog_flusher, "flog", NULL);
+	if (!flog_thread) {
+		if (flog_wake) SDL_DestroySemaphore(flog_wake);
+		flog_wake = NULL;
+		fclose(flog_fp);
+		flog_fp = NULL;
+		flog_gz_stop();
+		return 1;
+	}
+	flog_running.store(true);
+
+	if (!registered) {
+		atexit(flog_shutdown);
+		registered = true;
+	}
+
 	return 0;
 }
 
 
+/*
+ * Straight to a file of its own, bypassing the ring
+ */
 int flog_direct( std::filesystem::path logfile, const char *format, ... ) {
 
 	if (!flog_enabled) return 0;
@@ -68,60 +612,37 @@ int flog_direct( std::filesystem::path logfile, const char *format, ... ) {
 	va_list args;
 	va_start(args, format);
 
-	std::ofstream f;
-
-	f.open(logfile, std::ios::app|std::ios::binary);
-	if (f.is_open()) {
-		char buf[10240];
-
-		f << fmt::format("{:06} ", flog_millis() -flog_its);
-		vsnprintf(buf, sizeof(buf) -1,format,args);
-		va_end(args);
-		f << fmt::format("{}", buf);
-		f.close();
+	FILE *f = flog_fopen(logfile, true);
+	if (f) {
+		fprintf(f, "%06llu ", (unsigned long long)(flog_millis() -flog_its));
+		vfprintf(f, format, args);
+		fclose(f);
 	}
+	va_end(args);
+
 	return 0;
 }
 
 
+/*
+ * printf style, logged at FLOG_INFO
+ */
 int flog( const char *format, ... ) {
-	if (!flog_enabled) return 0;
-	char buf[10240];
+	if (!flog_enabled || flog_level.load(std::memory_order_relaxed) > FLOG_INFO) return 0;
 	va_list args;
 	va_start(args, format);
-
-	vsnprintf(buf, sizeof(buf) -1,format,args);
+	flog_record(false, format, args);
 	va_end(args);
 
-	std::ofstream f;
-
-	f.open(flogfile, std::ios::app|std::ios::binary);
-	if (f.is_open()) {
-
-		f << fmt::format("{:06} ", flog_millis() -flog_its);
-		f << fmt::format("{}", buf);
-		f.close();
-	}
 	return 0;
 }
 
 int flog_raw( const char *format, ... ) {
-	if (!flog_enabled) return 0;
-		va_list args;
+	if (!flog_enabled || flog_level.load(std::memory_order_relaxed) > FLOG_INFO) return 0;
+	va_list args;
 	va_start(args, format);
+	flog_record(true, format, args);
+	va_end(args);
 
-	std::ofstream f;
-
-	f.open(flogfile, std::ios::app|std::ios::binary);
-	if (f.is_open()) {
-		char buf[10240];
-
-		vsnprintf(buf, sizeof(buf) -1,format,args);
-		va_end(args);
-		f << buf;
-		f.close();
-	}
 	return 0;
 }
-
-
@@ -1,16 +1,112 @@
+#include <atomic>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <utility>
+#include <stdint.h>
 
 #ifndef __FLOG__
 #define __FLOG__
+
+#define FLOG_SLOTS 4096             // records in the ring, power of two
+#define FLOG_SLOT_TEXT 496          // longest record, longer ones are cut short
+#define FLOG_FLUSH_INTERVAL 50      // ms the flusher sleeps between batches
+#define FLOG_BATCH_SIZE 65536       // bytes per write()
+#define FLOG_ROTATE_BYTES (16 *1024 *1024) // start a new log past this size
+#define FLOG_ROTATE_SECONDS 86400   // or this age, whichever comes first
+#define FLOG_KEEP 10                // compressed logs kept
+#define FLOG_GZ_QUEUE 8             // rotated logs waiting on the compressor
+
+#ifndef FMT_HEADER_ONLY
+#define FMT_HEADER_ONLY
+#endif
+#include "fmt/compile.h"
+
+/*
+ * Levels for the flog_trace() .. flog_error() macros
+ */
+#define FLOG_TRACE 0
+#define FLOG_DEBUG 1
+#define FLOG_INFO 2
+#define FLOG_WARN 3
+#define FLOG_ERROR 4
+#define FLOG_OFF 5
+
+/*
+ * Anything below this is compiled out altogether, format string,
+ * arguments and all.  Per sample / per transaction chatter is trace.
+ */
+#ifndef FLOG_MIN_LEVEL
+#define FLOG_MIN_LEVEL FLOG_DEBUG
+#endif
+
+extern std::atomic<int> flog_level; // runtime minimum, FLOG_OFF while disabled
+
 //extern std::filesystem::path flogfile;
 void flog_enable( bool enable );
 int flog_init(std::filesystem::path flogfile);
+void flog_shutdown( void );
+void flog_rotate( uint64_t max_bytes, int max_seconds, int keep );
 int flog_direct( std::filesystem::path logfile, const char *format, ... );
 std::filesystem::path flog_flogfilename( void );
 int flog( const char *format, ... );
 int flog_raw( const char *format, ... );
+void flog_set_level( int level );
+int flog_level_parse( const char *name );
+
+struct flog_slot_s;
+struct flog_slot_s *flog_reserve( char **text, size_t *cap );
+void flog_commit( struct flog_slot_s *s, size_t len, bool truncated );
+
+/*
+ * fmt formats straight in to the log ring slot, nothing else is
+ * copied.  Only reached once the level check has passed.
+ */
+template <typename S, typename... T>
+void flog_fmt( const S &format, T&&... args ) {
+	char *text;
+	size_t cap;
+	struct flog_slot_s *s = flog_reserve(&text, &cap);
+
+	if (!s) return;
+	auto r = fmt::format_to_n(text, cap, format, std::forward<T>(args)...);
+	flog_commit(s, (r.size < cap) ? r.size : cap, (r.size > cap));
+}
+
+/*
+ * The level test comes first so the arguments aren't evaluated for
+ * a record nobody will see.  Format strings use fmt's {} syntax and
+ * are checked at compile time.
+ */
+#define FLOG_AT( level, format, ... ) do { \
+	if ((level) >= flog_level.load(std::memory_order_relaxed)) flog_fmt(FMT_COMPILE(format), ##__VA_ARGS__); \
+} while (0)
+
+#if FLOG_MIN_LEVEL <= FLOG_TRACE
+#define flog_trace(...) FLOG_AT(FLOG_TRACE, __VA_ARGS__)
+#else
+#define flog_trace(...) do { } while (0)
+#endif
+
+#if FLOG_MIN_LEVEL <= FLOG_DEBUG
+#define flog_debug(...) FLOG_AT(FLOG_DEBUG, __VA_ARGS__)
+#else
+#define flog_debug(...) do { } while (0)
+#endif
+
+#if FLOG_MIN_LEVEL <= FLOG_INFO
+#define flog_info(...) FLOG_AT(FLOG_INFO, __VA_ARGS__)
+#else
+#define flog_info(...) do { } while (0)
+#endif
+
+#if FLOG_MIN_LEVEL <= FLOG_WARN
+#define flog_warn(...) FLOG_AT(FLOG_WARN, __VA_ARGS__)
+#else
+#define flog_warn(...) do { } while (0)
+#endif
+
+#define flog_error(...) FLOG_AT(FLOG_ERROR, __VA_ARGS__)
 
 #ifndef  __FILENAME__
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
@@ -0,0 +1,320 @@
+#include <stdint.h>
+#include <string.h>
+#include <filesystem>
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+#include "flog.h"
+#include "atlas.h"
+#include "fontcache.h"
+#include "fontprovider.h"
+#include "trace.h"
+
+static void fontcache_entry_free( struct fontcache_entry_s *e ) {
+	atlas_free(&(e->line1));
+	atlas_free(&(e->line2));
+	e->size1 = e->size2 = 0;
+}
+
+/*
+ * Open both fonts at the given sizes and rasterise their atlases in
+ * to e.  Only touches FreeType and surfaces, never the renderer.
+ */
+static int fontcache_rasterise( struct fontcache_s *c, struct fontcache_entry_s *e, int size1, int size2 ) {
+	TTF_Font *f1, *f2;
+	int r = 1;
+
+	e->line1.texture = e->line2.texture = NULL;
+	e->line1.sheet = e->line2.sheet = NULL;
+	e->size1 = e->size2 = 0;
+	e->upload_failed = false;
+
+	f1 = font_open(c->font1, size1);
+	f2 = font_open(c->font2, size2);
+	if (f1 && f2) {
+		r = atlas_rasterise(&(e->line1), f1);
+		if (r == 0) r = atlas_rasterise(&(e->line2), f2);
+	} else {
+		flog("fontcache: could not open fonts at %d/%d px (%s)\n", size1, size2, TTF_GetError());
+	}
+	if (f1) TTF_CloseFont(f1);
+	if (f2) TTF_CloseFont(f2);
+
+	if (r == 0 && c->max_height && (e->line1.h > c->max_height || e->line2.h > c->max_height)) {
+		flog("fontcache: %d/%d px atlases are %d/%d tall, renderer limit is %d\n", size1, size2, e->line1.h, e->line2.h, c->max_height);
+		r = 1;
+	}
+
+	if (r != 0) {
+		fontcache_entry_free(e);
+		return 1;
+	}
+	e->size1 = size1;
+	e->size2 = size2;
+
+	return 0;
+}
+
+/*
+ * Worker, rasterises whatever size was asked for last.  Requests
+ * that arrive while it's busy collapse in to one, a drag only costs
+ * the sizes it's at when the worker comes up for air.
+ */
+static int fontcache_thread( void *arg ) {
+	struct fontcache_s *c = (struct fontcache_s *)arg;
+	int built1 = 0, built2 = 0;
+
+	trace_thread("fontcache");
+
+	while (1) {
+		struct fontcache_entry_s e;
+		int size1, size2, r;
+		uint32_t t;
+
+		SDL_SemWait(c->wake);
+		if (c->quit.load()) break;
+
+		SDL_LockMutex(c->lock);
+		size1 = c->want1;
+		size2 = c->want2;
+		SDL_UnlockMutex(c->lock);
+
+		if (size1 == built1 && size2 == built2) continue;
+
+		t = SDL_GetTicks();
+		trace_begin(TRACE_RASTERISE, size1, size2);
+		r = fontcache_rasterise(c, &e, size1, size2);
+		trace_end(TRACE_RASTERISE, r);
+		if (r != 0) continue; // not built, asking again ( after asking for another ) retries it
+		built1 = size1;
+		built2 = size2;
+		flog("fontcache: rasterised %d/%d px in %u ms\n", size1, size2, SDL_GetTicks() -t);
+
+		SDL_LockMutex(c->lock);
+		if (c->done.size1) fontcache_entry_free(&(c->done)); // never collected, no textures yet
+		c->done = e;
+		SDL_UnlockMutex(c->lock);
+
+		if (c->ready_event) {
+			SDL_Event ev;
+			SDL_zero(ev);
+			ev.type = c->ready_event;
+			SDL_PushEvent(&ev);
+		}
+	}
+
+	return 0;
+}
+
+static struct fontcache_entry_s *fontcache_find( struct fontcache_s *c, int size1, int size2 ) {
+	int i;
+
+	for (i = 0; i < FONTCACHE_SIZES; i++) {
+		if (c->entries[i].size1 == size1 && c->entries[i].size2 == size2) return &(c->entries[i]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Move a finished build from the worker in to the table, evicting
+ * the least recently used entry that isn't on screen
+ */
+static void fontcache_collect( struct fontcache_s *c ) {
+	struct fontcache_entry_s done, *slot = NULL;
+	int i;
+
+	SDL_LockMutex(c->lock);
+	done = c->done;
+	c->done = {};
+	SDL_UnlockMutex(c->lock);
+
+	if (!done.size1) return;
+
+	if (fontcache_find(c, done.size1, done.size2)) {
+		fontcache_entry_free(&done);
+		return;
+	}
+
+	for (i = 0; i < FONTCACHE_SIZES; i++) {
+		struct fontcache_entry_s *e = &(c->entries[i]);
+
+		if (e == c->current) continue;
+		if (!e->size1) { slot = e; break; }
+		if (!slot || e->used < slot->used) slot = e;
+	}
+
+	fontcache_entry_free(slot);
+	*slot = done;
+	slot->used = ++c->clock;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: fontcache_init
+  Returns Type	: int
+  ----Parameter List
+  1. struct fontcache_s *c,
+  2. const std::filesystem::path &font1, line1 font, see font_open()
+  3. const std::filesystem::path &font2, line2 font
+  4. int size1, starting point sizes
+  5. int size2,
+  6. SDL_Renderer *renderer,
+  7. Uint32 ready_event, SDL event type pushed as builds finish, 0 for none
+  ------------------
+  Exit Codes	: 0 - ok, 1 - failed
+  Side Effects	: starts the worker thread
+  --------------------------------------------------------------------
+Comments:
+  The starting size is built here and now, so there's always a
+  current entry to draw with.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int fontcache_init( struct fontcache_s *c, const std::filesystem::path &font1, const std::filesystem::path &font2, int size1, int size2, SDL_Renderer *renderer, Uint32 ready_event ) {
+	struct fontcache_entry_s *e;
+	SDL_RendererInfo info;
+	int i;
+
+	c->font1 = font1;
+	c->font2 = font2;
+	for (i = 0; i < FONTCACHE_SIZES; i++) c->entries[i] = {};
+	c->done = {};
+	c->current = NULL;
+	c->clock = 0;
+	c->max_height = 0;
+	c->want1 = size1;
+	c->want2 = size2;
+	c->ready_event = ready_event;
+	c->quit.store(false);
+	c->thread = NULL;
+
+	if (SDL_GetRendererInfo(renderer, &info) == 0) c->max_height = info.max_texture_height;
+
+	e = &(c->entries[0]);
+	if (fontcache_rasterise(c, e, size1, size2) != 0) return 1;
+	if (atlas_upload(&(e->line1), renderer) != 0 || atlas_upload(&(e->line2), renderer) != 0) {
+		fontcache_entry_free(e);
+		return 1;
+	}
+	e->used = ++c->clock;
+	c->current = e;
+
+	c->lock = SDL_CreateMutex();
+	c->wake = SDL_CreateSemaphore(0);
+	if (c->lock && c->wake) c->thread = SDL_CreateThread(fontcache_thread, "fontcache", c);
+	if (!c->thread) {
+		// Still usable, just stuck at the starting size
+		flog("fontcache: could not start worker (%s)\n", SDL_GetError());
+	}
+
+	return 0;
+}
+
+void fontcache_free( struct fontcache_s *c ) {
+	int i;
+
+	if (c->thread) {
+		c->quit.store(true);
+		SDL_SemPost(c->wake);
+		SDL_WaitThread(c->thread, NULL);
+		c->thread = NULL;
+	}
+
+	for (i = 0; i < FONTCACHE_SIZES; i++) fontcache_entry_free(&(c->entries[i]));
+	fontcache_entry_free(&(c->done));
+	c->current = NULL;
+
+	if (c->wake) SDL_DestroySemaphore(c->wake);
+	if (c->lock) SDL_DestroyMutex(c->lock);
+	c->wake = NULL;
+	c->lock = NULL;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: fontcache_get
+  Returns Type	: struct fontcache_entry_s *
+  ----Parameter List
+  1. struct fontcache_s *c,
+  2. SDL_Renderer *renderer,
+  3. int size1, point sizes wanted
+  4. int size2,
+  ------------------
+  Exit Codes	: the entry, now current, or NULL if it isn't ready yet
+  Side Effects	: may queue a build with the worker
+  --------------------------------------------------------------------
+Comments:
+  Render thread only.  On NULL keep drawing with the current entry
+  and try again once ready_event comes in.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+struct fontcache_entry_s *fontcache_get( struct fontcache_s *c, SDL_Renderer *renderer, int size1, int size2 ) {
+	struct fontcache_entry_s *e;
+	bool post = false;
+
+	if (c->thread) fontcache_collect(c);
+
+	e = fontcache_find(c, size1, size2);
+	if (e) {
+		if (!e->line1.texture || !e->line2.texture) {
+			if (e->upload_failed) return NULL;
+			if (atlas_upload(&(e->line1), renderer) != 0 || atlas_upload(&(e->line2), renderer) != 0) {
+				e->upload_failed = true; // until the next device reset
+				return NULL;
+			}
+		}
+		e->used = ++c->clock;
+		c->current = e;
+		return e;
+	}
+
+	if (!c->thread) return NULL;
+
+	// Atlas height goes roughly with the square of the point size
+	// ( taller rows, and more of them ), so going by the current entry
+	// a size the renderer could never take isn't even queued
+	//
+	//
+	if (c->max_height && c->current && c->current->size1 && c->current->size2) {
+		double r1 = (double)size1 / c->current->size1, r2 = (double)size2 / c->current->size2;
+
+		if (c->current->line1.h * r1 * r1 > c->max_height || c->current->line2.h * r2 * r2 > c->max_height) return NULL;
+	}
+
+	SDL_LockMutex(c->lock);
+	if (c->want1 != size1 || c->want2 != size2) {
+		c->want1 = size1;
+		c->want2 = size2;
+		post = true;
+	}
+	SDL_UnlockMutex(c->lock);
+	if (post) SDL_SemPost(c->wake);
+
+	return NULL;
+}
+
+/*
+ * The renderer has lost every texture, drop ours and bring
+ * back the one on screen.  The rest upload when next used.
+ */
+void fontcache_lost( struct fontcache_s *c, SDL_Renderer *renderer ) {
+	int i;
+
+	for (i = 0; i < FONTCACHE_SIZES; i++) {
+		struct fontcache_entry_s *e = &(c->entries[i]);
+
+		if (e->line1.texture) SDL_DestroyTexture(e->line1.texture);
+		if (e->line2.texture) SDL_DestroyTexture(e->line2.texture);
+		e->line1.texture = e->line2.texture = NULL;
+		e->upload_failed = false; // new device, worth another go
+	}
+
+	if (c->current) {
+		atlas_upload(&(c->current->line1), renderer);
+		atlas_upload(&(c->current->line2), renderer);
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef __FONTCACHE__
+#define __FONTCACHE__
+#include <atomic>
+#include <filesystem>
+#include <stdint.h>
+#include <SDL.h>
+
+#include "atlas.h"
+
+#define FONTCACHE_SIZES 4       // font size pairs kept rasterised
+
+/*
+ * Glyph atlases for both OSD lines at one pair of point sizes
+ */
+struct fontcache_entry_s {
+	int size1, size2;       // 0 for an empty slot
+	struct atlas_s line1, line2;
+	uint64_t used;          // LRU stamp
+	bool upload_failed;     // renderer wouldn't take the sheets, don't keep asking
+};
+
+/*
+ * The atlases for the last few window sizes, so dragging the window
+ * back and forth doesn't keep going back to FreeType.
+ *
+ * A missing size is rasterised by a worker thread, which only ever
+ * produces CPU side sheets in to done.  Everything touching textures,
+ * entries[] and current included, belongs to the render thread.
+ */
+struct fontcache_s {
+	std::filesystem::path font1, font2;
+	struct fontcache_entry_s entries[FONTCACHE_SIZES];
+	struct fontcache_entry_s *current;
+	uint64_t clock;
+	int max_height;         // SDL_RendererInfo max_texture_height, 0 if unknown
+
+	SDL_Thread *thread;
+	SDL_sem *wake;
+	SDL_mutex *lock;        // want1/2, done
+	std::atomic<bool> quit;
+	int want1, want2;       // latest size asked for
+	struct fontcache_entry_s done;  // finished by the worker, not yet collected
+	Uint32 ready_event;     // pushed when done is filled, 0 for none
+};
+
+int fontcache_init( struct fontcache_s *c, const std::filesystem::path &font1, const std::filesystem::path &font2, int size1, int size2, SDL_Renderer *renderer, Uint32 ready_event );
+void fontcache_free( struct fontcache_s *c );
+struct fontcache_entry_s *fontcache_get( struct fontcache_s *c, SDL_Renderer *renderer, int size1, int size2 );
+void fontcache_lost( struct fontcache_s *c, SDL_Renderer *renderer );
+
+#endif
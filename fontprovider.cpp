@@ -0,0 +1,253 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <filesystem>
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+#include "flog.h"
+#include "fontprovider.h"
+
+/*
+ * binary_to_compressed_c.cpp output, only ever pulled in here
+ */
+#include "RobotoMono-Regular.cpp"
+#include "RobotoMono-Bold.cpp"
+
+/*
+ * One compiled-in font.  The TTF is decompressed the first time
+ * anything asks for it and the copy kept for the life of the
+ * program, every TTF_Font opened on it reads straight from there.
+ */
+struct font_embedded_s {
+	const char *name;
+	const unsigned int *compressed;
+	unsigned int compressed_size;
+	unsigned char *data;    // NULL until first use
+	unsigned int len;
+	bool failed;            // don't retry a stream that didn't check out
+};
+
+static struct font_embedded_s font_table[] = {
+	{ FONT_EMBEDDED_REGULAR, RobotoMono_Regular_compressed_data, RobotoMono_Regular_compressed_size, NULL, 0, false },
+	{ FONT_EMBEDDED_BOLD, RobotoMono_Bold_compressed_data, RobotoMono_Bold_compressed_size, NULL, 0, false },
+	{ NULL, NULL, 0, NULL, 0, false }
+};
+
+static SDL_SpinLock font_lock = 0;
+
+
+/*
+ * stb_decompress(), the inverse of binary_to_compressed_c's stb_compress().
+ *
+ * The stream is a 16 byte header ( magic, 64 bit length ) then literal
+ * and back reference tokens, ending in 05 FA and an adler32 of the output.
+ */
+struct stb_state_s {
+	unsigned char *out_b;   // start of output
+	unsigned char *out_e;   // end of output
+	const unsigned char *in_b;
+	unsigned char *dout;    // write position
+};
+
+#define stb_in2(x) ((i[x] << 8) + i[(x) +1])
+#define stb_in3(x) ((i[x] << 16) + stb_in2((x) +1))
+#define stb_in4(x) ((i[x] << 24) + stb_in3((x) +1))
+
+static unsigned int stb_decompress_length( const unsigned char *i ) {
+	return (i[8] << 24) + (i[9] << 16) + (i[10] << 8) + i[11];
+}
+
+static void stb_match( struct stb_state_s *s, const unsigned char *data, unsigned int length ) {
+	// overlapping copies repeat the bytes just written, so no memmove()
+	if (s->dout +length > s->out_e) { s->dout = s->out_e +1; return; }
+	if (data < s->out_b) { s->dout = s->out_e +1; return; }
+	while (length--) *s->dout++ = *data++;
+}
+
+static void stb_lit( struct stb_state_s *s, const unsigned char *data, unsigned int length ) {
+	if (s->dout +length > s->out_e) { s->dout = s->out_e +1; return; }
+	if (data < s->in_b) { s->dout = s->out_e +1; return; }
+	memcpy(s->dout, data, length);
+	s->dout += length;
+}
+
+static const unsigned char *stb_decompress_token( struct stb_state_s *s, const unsigned char *i ) {
+	if (*i >= 0x20) {
+		if (*i >= 0x80) { stb_match(s, s->dout -i[1] -1, i[0] -0x80 +1); i += 2; }
+		else if (*i >= 0x40) { stb_match(s, s->dout -(stb_in2(0) -0x4000 +1), i[2] +1); i += 3; }
+		else { stb_lit(s, i +1, i[0] -0x20 +1); i += 1 +(i[0] -0x20 +1); }
+	} else {
+		if (*i >= 0x18) { stb_match(s, s->dout -(stb_in3(0) -0x180000 +1), i[3] +1); i += 4; }
+		else if (*i >= 0x10) { stb_match(s, s->dout -(stb_in3(0) -0x100000 +1), stb_in2(3) +1); i += 5; }
+		else if (*i >= 0x08) { stb_lit(s, i +2, stb_in2(0) -0x0800 +1); i += 2 +(stb_in2(0) -0x0800 +1); }
+		else if (*i == 0x07) { stb_lit(s, i +3, stb_in2(1) +1); i += 3 +(stb_in2(1) +1); }
+		else if (*i == 0x06) { stb_match(s, s->dout -(stb_in3(1) +1), i[4] +1); i += 5; }
+		else if (*i == 0x04) { stb_match(s, s->dout -(stb_in3(1) +1), stb_in2(4) +1); i += 6; }
+	}
+
+	return i;
+}
+
+static unsigned int stb_adler32( unsigned int adler32, const unsigned char *buffer, unsigned int buflen ) {
+	const unsigned long ADLER_MOD = 65521;
+	unsigned long s1 = adler32 & 0xffff, s2 = adler32 >> 16;
+	unsigned long blocklen = buflen % 5552;
+	unsigned long i;
+
+	while (buflen) {
+		for (i = 0; i < blocklen; i++) {
+			s1 += *buffer++;
+			s2 += s1;
+		}
+		s1 %= ADLER_MOD;
+		s2 %= ADLER_MOD;
+		buflen -= blocklen;
+		blocklen = 5552;
+	}
+
+	return (unsigned int)(s2 << 16) +(unsigned int)s1;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: stb_decompress
+  Returns Type	: unsigned int
+  ----Parameter List
+  1. unsigned char *output, at least stb_decompress_length() bytes
+  2. const unsigned char *i, compressed stream
+  3. unsigned int length, of the compressed stream
+  ------------------
+  Exit Codes	: bytes written, 0 on a bad or corrupt stream
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Every token is bounds checked against both buffers, a stream that
+  runs off either end or fails the adler32 is rejected rather than
+  handed to FreeType.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+static unsigned int stb_decompress( unsigned char *output, const unsigned char *i, unsigned int length ) {
+	struct stb_state_s s;
+	const unsigned char *end = i +length;
+	unsigned int olen;
+
+	if (length < 16) return 0;
+	if (stb_in4(0) != 0x57bC0000) return 0;
+	if (stb_in4(4) != 0) return 0; // > 4GB
+
+	olen = stb_decompress_length(i);
+	s.in_b = i;
+	s.out_b = output;
+	s.out_e = output +olen;
+	s.dout = output;
+	i += 16;
+
+	while (i < end) {
+		const unsigned char *old_i = i;
+
+		i = stb_decompress_token(&s, i);
+		if (i == old_i) {
+			if (*i == 0x05 && i +6 <= end && i[1] == 0xfa) {
+				if (s.dout != output +olen) return 0;
+				if (stb_adler32(1, output, olen) != (unsigned int)stb_in4(2)) return 0;
+				return olen;
+			}
+			return 0;
+		}
+		if (s.dout > output +olen) return 0;
+	}
+
+	return 0;
+}
+
+
+/*-----------------------------------------------------------------\
+  Function Name	: font_embedded
+  Returns Type	: int
+  ----Parameter List
+  1. const char *name, FONT_EMBEDDED_*
+  2. const unsigned char **data, set to the decompressed TTF
+  3. size_t *len,
+  ------------------
+  Exit Codes	: 0 - ok, 1 - not an embedded font or it didn't decompress
+  Side Effects	: decompresses the font on first call
+  --------------------------------------------------------------------
+Comments:
+  Safe to call from any thread, the first caller for each font does
+  the work and everyone after gets the same copy.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int font_embedded( const char *name, const unsigned char **data, size_t *len ) {
+	struct font_embedded_s *f;
+	int result = 1;
+
+	for (f = font_table; f->name; f++) {
+		if (SDL_strcasecmp(f->name, name) == 0) break;
+	}
+	if (!f->name) return 1;
+
+	SDL_AtomicLock(&font_lock);
+	if (!f->data && !f->failed) {
+		const unsigned char *src = (const unsigned char *)f->compressed;
+		unsigned int olen = stb_decompress_length(src);
+		unsigned int t = SDL_GetTicks();
+
+		f->data = (unsigned char *)malloc(olen ? olen : 1);
+		if (f->data && stb_decompress(f->data, src, f->compressed_size) == olen) {
+			f->len = olen;
+			flog("font: %s decompressed, %u bytes in %u ms\n", f->name, olen, SDL_GetTicks() -t);
+		} else {
+			flog("font: embedded %s failed to decompress\n", f->name);
+			free(f->data);
+			f->data = NULL;
+			f->failed = true;
+		}
+	}
+	if (f->data) {
+		*data = f->data;
+		*len = f->len;
+		result = 0;
+	}
+	SDL_AtomicUnlock(&font_lock);
+
+	return result;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: font_open
+  Returns Type	: TTF_Font *
+  ----Parameter List
+  1. const std::filesystem::path &name, font file
+  2. int size, point size
+  ------------------
+  Exit Codes	: NULL on failure, as TTF_OpenFont()
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  A bare name matching one of the compiled-in fonts is opened from
+  memory, so the default configuration never touches the disk.
+  Anything with a directory, or not embedded, is a normal file
+  and goes to TTF_OpenFont().
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+TTF_Font *font_open( const std::filesystem::path &name, int size ) {
+	const unsigned char *data;
+	size_t len;
+
+	if (!name.has_parent_path() && font_embedded(name.string().c_str(), &data, &len) == 0) {
+		SDL_RWops *rw = SDL_RWFromConstMem(data, (int)len);
+		if (rw) return TTF_OpenFontRW(rw, 1, size);
+		flog("font: could not wrap embedded %s (%s)\n", name.string().c_str(), SDL_GetError());
+	}
+
+	return TTF_OpenFont(name.string().c_str(), size);
+}
@@ -0,0 +1,17 @@
+#ifndef __FONTPROVIDER__
+#define __FONTPROVIDER__
+#include <filesystem>
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+/*
+ * Fonts compiled in to the binary, asking for one of these names
+ * gets the embedded copy rather than a file from disk
+ */
+#define FONT_EMBEDDED_REGULAR "RobotoMono-Regular.ttf"
+#define FONT_EMBEDDED_BOLD "RobotoMono-Bold.ttf"
+
+TTF_Font *font_open( const std::filesystem::path &name, int size );
+int font_embedded( const char *name, const unsigned char **data, size_t *len );
+
+#endif
@@ -0,0 +1,144 @@
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "flog.h"
+#include "frameexport.h"
+
+static_assert(sizeof(struct frame_header_s) <= FRAME_EXPORT_HEADER_SIZE, "frame header outgrew its reserved space");
+
+/*-----------------------------------------------------------------\
+  Function Name	: frame_export_open
+  Returns Type	: int
+  ----Parameter List
+  1. struct frame_export_s *fe,
+  2. const char *name, segment name, "Local\name" mapping on Windows,
+     "/name" in /dev/shm elsewhere
+  3. int width, of the frames in pixels
+  4. int height,
+  ------------------
+  Exit Codes	: 0 - ok, 1 - could not create/map the segment
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int frame_export_open( struct frame_export_s *fe, const char *name, int width, int height ) {
+	void *base;
+
+	fe->size = FRAME_EXPORT_HEADER_SIZE + (size_t)width * height * 4;
+	fe->hdr = NULL;
+	fe->pixels = NULL;
+
+#ifdef _WIN32
+	snprintf(fe->name, sizeof(fe->name), "Local\\%s", name);
+	fe->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)fe->size >> 32), (DWORD)(fe->size & 0xffffffff), fe->name);
+	if (fe->mapping == NULL) {
+		flog("frame_export: CreateFileMapping(%s) failed (%ld)\n", fe->name, GetLastError());
+		return 1;
+	}
+
+	base = MapViewOfFile(fe->mapping, FILE_MAP_ALL_ACCESS, 0, 0, fe->size);
+	if (base == NULL) {
+		flog("frame_export: MapViewOfFile(%s) failed (%ld)\n", fe->name, GetLastError());
+		CloseHandle(fe->mapping);
+		fe->mapping = NULL;
+		return 1;
+	}
+#else
+	snprintf(fe->name, sizeof(fe->name), "/%s", name);
+	fe->fd = shm_open(fe->name, O_CREAT | O_RDWR, 0644);
+	if (fe->fd < 0) {
+		flog("frame_export: shm_open(%s) failed (%s)\n", fe->name, strerror(errno));
+		return 1;
+	}
+
+	if (ftruncate(fe->fd, fe->size) != 0) {
+		flog("frame_export: could not size %s to %ld bytes (%s)\n", fe->name, (long)fe->size, strerror(errno));
+		close(fe->fd);
+		fe->fd = -1;
+		return 1;
+	}
+
+	base = mmap(NULL, fe->size, PROT_READ | PROT_WRITE, MAP_SHARED, fe->fd, 0);
+	if (base == MAP_FAILED) {
+		flog("frame_export: mmap(%s) failed (%s)\n", fe->name, strerror(errno));
+		close(fe->fd);
+		fe->fd = -1;
+		return 1;
+	}
+#endif
+
+	memset(base, 0, fe->size);
+	fe->hdr = new (base) frame_header_s;
+	fe->pixels = (uint8_t *)base + FRAME_EXPORT_HEADER_SIZE;
+
+	fe->hdr->magic = FRAME_EXPORT_MAGIC;
+	fe->hdr->version = FRAME_EXPORT_VERSION;
+	fe->hdr->width = width;
+	fe->hdr->height = height;
+	fe->hdr->stride = width * 4;
+	fe->hdr->format = FRAME_EXPORT_BGRA8888;
+	fe->hdr->timestamp_ms = 0;
+	fe->hdr->frame.store(0, std::memory_order_release);
+
+	flog("frame_export: %dx%d BGRA frames at %s ( %ld bytes )\n", width, height, fe->name, (long)fe->size);
+
+	return 0;
+}
+
+/*
+ * Copy a finished frame in, pixels being ARGB8888 ( BGRA byte order
+ * in memory on the little endian machines we run on ) with the
+ * given pitch
+ */
+void frame_export_write( struct frame_export_s *fe, const void *pixels, int pitch, uint64_t timestamp_ms ) {
+	uint64_t frame;
+	uint32_t y;
+
+	if (!fe->hdr) return;
+
+	frame = fe->hdr->frame.load(std::memory_order_relaxed);
+	fe->hdr->frame.store(frame +1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (y = 0; y < fe->hdr->height; y++) {
+		memcpy(fe->pixels + y * fe->hdr->stride, (const uint8_t *)pixels + y * pitch, fe->hdr->stride);
+	}
+	fe->hdr->timestamp_ms = timestamp_ms;
+
+	fe->hdr->frame.store(frame +2, std::memory_order_release);
+}
+
+void frame_export_close( struct frame_export_s *fe ) {
+	if (!fe->hdr) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(fe->hdr);
+	CloseHandle(fe->mapping);
+	fe->mapping = NULL;
+#else
+	munmap(fe->hdr, fe->size);
+	close(fe->fd);
+	shm_unlink(fe->name);
+	fe->fd = -1;
+#endif
+
+	fe->hdr = NULL;
+	fe->pixels = NULL;
+}
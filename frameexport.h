@@ -0,0 +1,54 @@
+#ifndef __FRAMEEXPORT__
+#define __FRAMEEXPORT__
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define FRAME_EXPORT_MAGIC 0x46354B42   // "BK5F"
+#define FRAME_EXPORT_VERSION 1
+#define FRAME_EXPORT_BGRA8888 0
+#define FRAME_EXPORT_NAME_SIZE 256
+
+/*
+ * Layout at the start of the shared segment, pixels follow at
+ * FRAME_EXPORT_HEADER_SIZE.
+ *
+ * frame works as a sequence lock: it's odd while a frame is being
+ * copied in and even once it's complete.  A reader copies the pixels
+ * out and only keeps them if frame was the same even value both
+ * before and after.
+ */
+struct frame_header_s {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;        // bytes per row
+	uint32_t format;        // FRAME_EXPORT_BGRA8888
+	std::atomic<uint64_t> frame;
+	uint64_t timestamp_ms;  // SDL ticks when the frame was written
+};
+
+#define FRAME_EXPORT_HEADER_SIZE 64
+
+struct frame_export_s {
+	char name[FRAME_EXPORT_NAME_SIZE];
+	size_t size;
+	struct frame_header_s *hdr;
+	uint8_t *pixels;
+#ifdef _WIN32
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+};
+
+int frame_export_open( struct frame_export_s *fe, const char *name, int width, int height );
+void frame_export_write( struct frame_export_s *fe, const void *pixels, int pitch, uint64_t timestamp_ms );
+void frame_export_close( struct frame_export_s *fe );
+
+#endif
@@ -0,0 +1,123 @@
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <SDL.h>
+
+#include "perf.h"
+
+void perf_init( struct perf_s *p ) {
+	p->write_at = 0;
+	p->rtt_sum_us.store(0);
+	p->rtt_count.store(0);
+	p->rtt_max_us.store(0);
+	p->timeouts.store(0);
+
+	p->window_start = SDL_GetTicks64();
+	p->samples = 0;
+	p->frames = 0;
+	p->render_sum_us = 0;
+	p->render_max_us = 0;
+	p->depth_max = 0;
+}
+
+uint64_t perf_now_us( void ) {
+	static uint64_t freq = 0;
+
+	if (!freq) freq = SDL_GetPerformanceFrequency();
+
+	return (uint64_t)((double)SDL_GetPerformanceCounter() * 1000000.0 / (double)freq);
+}
+
+/*
+ * A request has just gone out to the meter
+ */
+void perf_write( struct perf_s *p ) {
+	p->write_at = perf_now_us();
+}
+
+/*
+ * A response came back ( or didn't ).  The round trip is taken from
+ * the last write, so every reply to a pipelined batch is timed from
+ * when the batch went out.
+ */
+void perf_response( struct perf_s *p, bool ok ) {
+	uint32_t rtt, max;
+
+	if (!ok) {
+		p->timeouts.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	if (!p->write_at) return;
+
+	rtt = (uint32_t)(perf_now_us() -p->write_at);
+	p->rtt_sum_us.fetch_add(rtt, std::memory_order_relaxed);
+	p->rtt_count.fetch_add(1, std::memory_order_relaxed);
+
+	max = p->rtt_max_us.load(std::memory_order_relaxed);
+	while (rtt > max && !p->rtt_max_us.compare_exchange_weak(max, rtt, std::memory_order_relaxed));
+}
+
+/*
+ * Render thread drained n samples, depth being how many were waiting
+ */
+void perf_samples( struct perf_s *p, uint32_t n, size_t depth ) {
+	p->samples += n;
+	if (depth > p->depth_max) p->depth_max = depth;
+}
+
+void perf_frame( struct perf_s *p, uint64_t us ) {
+	p->frames++;
+	p->render_sum_us += us;
+	if (us > p->render_max_us) p->render_max_us = (uint32_t)us;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: perf_snapshot
+  Returns Type	: bool
+  ----Parameter List
+  1. struct perf_s *p,
+  2. uint64_t now, SDL ticks
+  3. struct perf_snapshot_s *s, filled in when a window closes
+  ------------------
+  Exit Codes	: true if a window closed and *s was updated
+  Side Effects	: starts the next window
+  --------------------------------------------------------------------
+Comments:
+  Render thread only.  The serial counters are swapped out rather
+  than read and cleared, so a reply landing in between is counted
+  in one window or the other but never lost.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+bool perf_snapshot( struct perf_s *p, uint64_t now, struct perf_snapshot_s *s ) {
+	uint64_t elapsed = now -p->window_start;
+	uint64_t rtt_sum;
+	uint32_t rtt_count, rtt_max;
+
+	if (elapsed < PERF_WINDOW_MS) return false;
+
+	rtt_sum = p->rtt_sum_us.exchange(0, std::memory_order_relaxed);
+	rtt_count = p->rtt_count.exchange(0, std::memory_order_relaxed);
+	rtt_max = p->rtt_max_us.exchange(0, std::memory_order_relaxed);
+
+	s->samples_per_s = p->samples * 1000.0 / elapsed;
+	s->fps = p->frames * 1000.0 / elapsed;
+	s->rtt_count = rtt_count;
+	s->rtt_avg_ms = rtt_count ? (rtt_sum / 1000.0) / rtt_count : 0.0;
+	s->rtt_max_ms = rtt_max / 1000.0;
+	s->render_avg_ms = p->frames ? (p->render_sum_us / 1000.0) / p->frames : 0.0;
+	s->render_max_ms = p->render_max_us / 1000.0;
+	s->depth_max = p->depth_max;
+	s->timeouts = p->timeouts.load(std::memory_order_relaxed);
+
+	p->window_start = now;
+	p->samples = 0;
+	p->frames = 0;
+	p->render_sum_us = 0;
+	p->render_max_us = 0;
+	p->depth_max = 0;
+
+	return true;
+}
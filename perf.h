@@ -0,0 +1,52 @@
+#ifndef __PERF__
+#define __PERF__
+#include <atomic>
+#include <stdint.h>
+
+#define PERF_WINDOW_MS 1000
+
+/*
+ * Live counters behind the HUD.
+ *
+ * The serial side is only updated by whichever thread owns the meter
+ * I/O ( the acquisition thread once it's running ) and read through
+ * the atomics.  The rest belongs to the render thread.  Counters are
+ * accumulated over PERF_WINDOW_MS then folded in to a snapshot.
+ */
+struct perf_s {
+	uint64_t write_at;      // perf_now_us() of the last write, I/O side only
+	std::atomic<uint64_t> rtt_sum_us;
+	std::atomic<uint32_t> rtt_count;
+	std::atomic<uint32_t> rtt_max_us;
+	std::atomic<uint32_t> timeouts;
+
+	uint64_t window_start;  // SDL ticks
+	uint32_t samples;
+	uint32_t frames;
+	uint64_t render_sum_us;
+	uint32_t render_max_us;
+	size_t depth_max;       // deepest the sample queue got before a drain
+};
+
+/*
+ * Per second figures for the last complete window
+ */
+struct perf_snapshot_s {
+	double samples_per_s;
+	double fps;
+	double rtt_avg_ms, rtt_max_ms;
+	uint32_t rtt_count;
+	double render_avg_ms, render_max_ms;
+	size_t depth_max;
+	uint32_t timeouts;      // since start
+};
+
+void perf_init( struct perf_s *p );
+uint64_t perf_now_us( void );
+void perf_write( struct perf_s *p );
+void perf_response( struct perf_s *p, bool ok );
+void perf_samples( struct perf_s *p, uint32_t n, size_t depth );
+void perf_frame( struct perf_s *p, uint64_t us );
+bool perf_snapshot( struct perf_s *p, uint64_t now, struct perf_snapshot_s *s );
+
+#endif
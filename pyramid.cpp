@@ -0,0 +1,345 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "flog.h"
+#include "pyramid.h"
+
+static void node_merge( struct pyramid_node_s *into, const struct pyramid_node_s *n ) {
+	if (into->count == 0) {
+		*into = *n;
+		return;
+	}
+	if (n->count == 0) return;
+
+	if (n->t0 < into->t0) into->t0 = n->t0;
+	if (n->t1 > into->t1) into->t1 = n->t1;
+	if (n->min < into->min) into->min = n->min;
+	if (n->max > into->max) into->max = n->max;
+	into->sum += n->sum;
+	into->count += n->count;
+}
+
+/*
+ * Node j of a level, completed or the partial one.  NULL if it's
+ * already fallen out of the ring or doesn't exist yet.
+ */
+static const struct pyramid_node_s *node_at( struct pyramid_s *p, int k, size_t j ) {
+	struct pyramid_level_s *l = &(p->level[k]);
+
+	if (j == l->head) return (l->partial.count) ? &(l->partial) : NULL;
+	if (j > l->head) return NULL;
+	if (l->head -j > p->capacity) return NULL;
+
+	return &(l->nodes[j % p->capacity]);
+}
+
+/*
+ * Lowest index retained at level k
+ */
+static size_t level_first( struct pyramid_s *p, int k ) {
+	size_t head = p->level[k].head;
+
+	return (head > p->capacity) ? head -p->capacity : 0;
+}
+
+int pyramid_init( struct pyramid_s *p, size_t memory_bytes ) {
+	int k;
+
+	p->capacity = memory_bytes / (PYRAMID_LEVELS * sizeof(struct pyramid_node_s));
+	if (p->capacity < PYRAMID_FANOUT) p->capacity = PYRAMID_FANOUT;
+
+	for (k = 0; k < PYRAMID_LEVELS; k++) {
+		p->level[k].nodes = (struct pyramid_node_s *)calloc(p->capacity, sizeof(struct pyramid_node_s));
+		if (!p->level[k].nodes) {
+			flog("pyramid: could not allocate level %d ( %ld nodes )\n", k, (long)p->capacity);
+			while (k--) free(p->level[k].nodes);
+			p->capacity = 0;
+			return 1;
+		}
+	}
+	pyramid_reset(p);
+
+	flog("pyramid: %d levels of %ld nodes, %ld readings at full detail\n", PYRAMID_LEVELS, (long)p->capacity, (long)p->capacity);
+
+	return 0;
+}
+
+void pyramid_free( struct pyramid_s *p ) {
+	int k;
+
+	for (k = 0; k < PYRAMID_LEVELS; k++) {
+		free(p->level[k].nodes);
+		p->level[k].nodes = NULL;
+	}
+	p->capacity = 0;
+}
+
+void pyramid_reset( struct pyramid_s *p ) {
+	int k;
+
+	for (k = 0; k < PYRAMID_LEVELS; k++) {
+		p->level[k].head = 0;
+		p->level[k].partial.count = 0;
+		p->level[k].children = 0;
+	}
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: pyramid_add
+  Returns Type	: void
+  ----Parameter List
+  1. struct pyramid_s *p,
+  2. uint64_t ts, readings must arrive in time order
+  3. double value,
+  ------------------
+  Exit Codes	:
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  The reading becomes a level 0 node, and each time a level fills
+  a group of PYRAMID_FANOUT the group's summary is carried up to the
+  next level's partial node.  Amortised O(1) per reading.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+void pyramid_add( struct pyramid_s *p, uint64_t ts, double value ) {
+	struct pyramid_node_s n;
+	int k;
+
+	if (!p->capacity) return;
+
+	n.t0 = n.t1 = ts;
+	n.min = n.max = n.sum = value;
+	n.count = 1;
+
+	// Level 0 holds the readings themselves
+	//
+	p->level[0].nodes[p->level[0].head % p->capacity] = n;
+	p->level[0].head++;
+
+	for (k = 1; k < PYRAMID_LEVELS; k++) {
+		struct pyramid_level_s *l = &(p->level[k]);
+
+		node_merge(&(l->partial), &n);
+		if (++l->children < PYRAMID_FANOUT) break;
+
+		// Group complete, it becomes a node of this level and
+		// is itself carried up to the next
+		//
+		n = l->partial;
+		l->nodes[l->head % p->capacity] = n;
+		l->head++;
+		l->partial.count = 0;
+		l->children = 0;
+	}
+}
+
+/*
+ * Time of the oldest reading still summarised anywhere
+ */
+bool pyramid_oldest( struct pyramid_s *p, uint64_t *ts ) {
+	int k;
+
+	for (k = PYRAMID_LEVELS -1; k >= 0; k--) {
+		const struct pyramid_node_s *n = node_at(p, k, level_first(p, k));
+		if (n) {
+			*ts = n->t0;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: pyramid_query
+  Returns Type	: bool
+  ----Parameter List
+  1. struct pyramid_s *p,
+  2. uint64_t t0, start of the range, inclusive
+  3. uint64_t t1, end of the range, exclusive
+  4. struct pyramid_node_s *out, min/max/sum/count over the range
+  ------------------
+  Exit Codes	: false if nothing is held for that range
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Works at the finest level that still reaches back to t0, binary
+  searching it for the nodes overlapping the range, plus the partial
+  nodes below it if the range runs up to the present.  The interior is
+  then covered the same way as a segment tree, taking odd nodes off
+  each end and stepping up a level, for O(log n) nodes in all.
+  Ranges older than level 0 holds come back at the resolution of
+  whichever level still covers them.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+bool pyramid_query( struct pyramid_s *p, uint64_t t0, uint64_t t1, struct pyramid_node_s *out ) {
+	const struct pyramid_node_s *last;
+	size_t a, b, lo, hi;
+	int k, start;
+
+	out->count = 0;
+	if (!p->capacity || t1 <= t0) return false;
+
+	// Finest level that still goes back as far as t0, or failing
+	// that the coarsest level holding anything at all
+	//
+	//
+	for (k = 0; k < PYRAMID_LEVELS; k++) {
+		const struct pyramid_node_s *n = node_at(p, k, level_first(p, k));
+		if (n && n->t0 <= t0) break;
+	}
+	if (k == PYRAMID_LEVELS) {
+		for (k = PYRAMID_LEVELS -1; k > 0; k--) {
+			if (node_at(p, k, level_first(p, k))) break;
+		}
+	}
+	start = k;
+
+	// a = first node ending at or after t0, b = first node starting at or after t1
+	//
+	//
+	lo = level_first(p, k);
+	hi = p->level[k].head +1;
+	while (lo < hi) {
+		size_t mid = lo +(hi -lo) /2;
+		const struct pyramid_node_s *n = node_at(p, k, mid);
+		if (n && n->t1 < t0) lo = mid +1; else hi = mid;
+	}
+	a = lo;
+
+	hi = p->level[k].head +1;
+	while (lo < hi) {
+		size_t mid = lo +(hi -lo) /2;
+		const struct pyramid_node_s *n = node_at(p, k, mid);
+		if (n && n->t0 < t1) lo = mid +1; else hi = mid;
+	}
+	b = lo;
+
+	// The newest readings haven't made it up to this level yet, they're
+	// in the partial nodes of the levels below.  Those are disjoint and
+	// each newer than the one above it.  They're wanted whenever the range
+	// runs past the last completed node here, even if this level's own
+	// partial is still empty ( a node has only just been completed ).
+	//
+	//
+	last = (p->level[start].head) ? node_at(p, start, p->level[start].head -1) : NULL;
+	if (!last || t1 > last->t1) {
+		for (k = start -1; k >= 1; k--) {
+			const struct pyramid_node_s *n = &(p->level[k].partial);
+			if (n->count && n->t0 < t1 && n->t1 >= t0) node_merge(out, n);
+		}
+	}
+	k = start;
+
+	// Climb.  Partial nodes don't include the partial below them, so
+	// the partial at this level ( if in range ) is taken on its own first
+	//
+	//
+	for (; k < PYRAMID_LEVELS && a < b; k++) {
+		const struct pyramid_node_s *n;
+
+		if (b > p->level[k].head) {
+			n = node_at(p, k, p->level[k].head);
+			if (n) node_merge(out, n);
+			b = p->level[k].head;
+		}
+		if (k == PYRAMID_LEVELS -1) break;
+
+		while (a < b && (a % PYRAMID_FANOUT)) {
+			if ((n = node_at(p, k, a))) node_merge(out, n);
+			a++;
+		}
+		while (a < b && (b % PYRAMID_FANOUT)) {
+			b--;
+			if ((n = node_at(p, k, b))) node_merge(out, n);
+		}
+		a /= PYRAMID_FANOUT;
+		b /= PYRAMID_FANOUT;
+	}
+
+	// Whatever's left at the top level
+	//
+	for (; a < b && k < PYRAMID_LEVELS; a++) {
+		const struct pyramid_node_s *n = node_at(p, k, a);
+		if (n) node_merge(out, n);
+	}
+
+	return (out->count > 0);
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: pyramid_selftest
+  Returns Type	: int
+  ----Parameter List
+  1. void,
+  ------------------
+  Exit Codes	: 0 - ok, 1 - a query disagreed with brute force
+  Side Effects	: prints the first failure to stderr
+  --------------------------------------------------------------------
+Comments:
+  Run by bk5490c -T.  A small pyramid is fed pseudo random readings
+  and after every one the last few and the last many readings are
+  queried and checked against a plain scan.  Ranges inside level 0
+  must come back exact; older ones come back at a coarser level, so
+  there the answer has to cover the range ( count no lower, min/max
+  no tighter ) and must always reach the newest reading.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int pyramid_selftest( void ) {
+	const size_t capacity = 16, readings = 20000, spans[] = { 8, 200, 5000 };
+	struct pyramid_s p;
+	double *values;
+	uint32_t seed = 12345;
+	size_t n, i, s;
+	int r = 0;
+
+	values = (double *)malloc(readings * sizeof(double));
+	if (!values) return 1;
+	if (pyramid_init(&p, capacity * PYRAMID_LEVELS * sizeof(struct pyramid_node_s)) != 0) {
+		free(values);
+		return 1;
+	}
+
+	for (n = 0; n < readings && r == 0; n++) {
+		seed = seed * 1103515245 +12345;
+		values[n] = (double)((seed >> 16) & 0x7fff);
+		pyramid_add(&p, n, values[n]);
+
+		for (s = 0; s < sizeof(spans) / sizeof(spans[0]) && r == 0; s++) {
+			struct pyramid_node_s out;
+			size_t first = (n +1 > spans[s]) ? n +1 -spans[s] : 0;
+			double min = values[first], max = values[first];
+			bool exact = (spans[s] <= capacity);
+
+			for (i = first; i <= n; i++) {
+				if (values[i] < min) min = values[i];
+				if (values[i] > max) max = values[i];
+			}
+
+			if (!pyramid_query(&p, first, n +1, &out) || out.t1 != n
+					|| (exact && (out.count != n +1 -first || out.min != min || out.max != max))
+					|| (!exact && (out.count < n +1 -first || out.min > min || out.max < max))) {
+				fprintf(stderr, "pyramid: query [%ld, %ld] after %ld readings gave count %ld min %g max %g t1 %ld, wanted count %ld min %g max %g\n",
+						(long)first, (long)n, (long)(n +1), (long)out.count, out.min, out.max, (long)out.t1,
+						(long)(n +1 -first), min, max);
+				r = 1;
+			}
+		}
+	}
+
+	pyramid_free(&p);
+	free(values);
+
+	return r;
+}
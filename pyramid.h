@@ -0,0 +1,52 @@
+#ifndef __PYRAMID__
+#define __PYRAMID__
+#include <stddef.h>
+#include <stdint.h>
+
+#define PYRAMID_FANOUT 4
+#define PYRAMID_LEVELS 12       // level 11 spans 4^11 readings per node
+#define DEFAULT_PYRAMID_MB 16
+
+/*
+ * Summary of a run of readings.  At level 0 each node is a single
+ * reading, at level k each node summarises PYRAMID_FANOUT nodes of
+ * level k-1.
+ */
+struct pyramid_node_s {
+	uint64_t t0, t1;        // SDL ticks of the first and last reading covered
+	double min, max;
+	double sum;
+	uint64_t count;
+};
+
+/*
+ * One level, a ring of the most recent completed nodes plus the
+ * node still being filled ( partial ).  Node j at this level has
+ * ring slot j % capacity and is retained while j >= head -capacity.
+ */
+struct pyramid_level_s {
+	struct pyramid_node_s *nodes;
+	size_t head;            // completed nodes, free running
+	struct pyramid_node_s partial;
+	int children;           // level k-1 nodes folded in to partial so far
+};
+
+/*
+ * Every level gets the same number of slots, so each level going up
+ * retains PYRAMID_FANOUT times as much time at a quarter of the detail.
+ * Old readings fall out of the fine levels long before the coarse ones.
+ */
+struct pyramid_s {
+	size_t capacity;        // slots per level
+	struct pyramid_level_s level[PYRAMID_LEVELS];
+};
+
+int pyramid_init( struct pyramid_s *p, size_t memory_bytes );
+void pyramid_free( struct pyramid_s *p );
+void pyramid_reset( struct pyramid_s *p );
+void pyramid_add( struct pyramid_s *p, uint64_t ts, double value );
+bool pyramid_query( struct pyramid_s *p, uint64_t t0, uint64_t t1, struct pyramid_node_s *out );
+bool pyramid_oldest( struct pyramid_s *p, uint64_t *ts );
+int pyramid_selftest( void );
+
+#endif
@@ -0,0 +1,49 @@
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "samples.h"
+
+void sampleq_init( struct sampleq_s *q ) {
+	q->head.store(0);
+	q->tail.store(0);
+	q->dropped.store(0);
+}
+
+/*
+ * Producer side.  If the renderer has fallen a full queue behind
+ * we drop the new sample rather than block the meter I/O.
+ */
+bool sampleq_push( struct sampleq_s *q, const struct meter_sample_s *s ) {
+	size_t head = q->head.load(std::memory_order_relaxed);
+	size_t tail = q->tail.load(std::memory_order_acquire);
+
+	if (head - tail >= SAMPLEQ_SIZE) {
+		q->dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	q->slots[head & (SAMPLEQ_SIZE -1)] = *s;
+	q->head.store(head +1, std::memory_order_release);
+
+	return true;
+}
+
+/*
+ * Consumer side.  Returns false if there's nothing waiting.
+ */
+bool sampleq_pop( struct sampleq_s *q, struct meter_sample_s *s ) {
+	size_t tail = q->tail.load(std::memory_order_relaxed);
+	size_t head = q->head.load(std::memory_order_acquire);
+
+	if (tail == head) return false;
+
+	*s = q->slots[tail & (SAMPLEQ_SIZE -1)];
+	q->tail.store(tail +1, std::memory_order_release);
+
+	return true;
+}
+
+size_t sampleq_depth( struct sampleq_s *q ) {
+	return q->head.load(std::memory_order_acquire) - q->tail.load(std::memory_order_acquire);
+}
@@ -0,0 +1,47 @@
+#ifndef __SAMPLES__
+#define __SAMPLES__
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * One reading as taken by the acquisition thread, carrying
+ * everything the renderer needs to compose the OSD lines
+ * without having to go back to the meter.
+ */
+struct meter_sample_s {
+	uint64_t ts;            // SDL ticks (ms) when the reading was returned
+	int mode;               // MMODES_* the reading was taken in
+	double value;
+	double range;
+	double precision;
+	char mode_str[20];      // mode as reported by CONF?, ie "VOLT"
+	char conf[128];         // raw CONF? response
+	char raw[64];           // raw READ? response
+	char profile[20];       // speed profile label, "" if the function has none
+};
+
+/*
+ * Single producer / single consumer ring of samples.
+ *
+ * Only the acquisition thread calls sampleq_push() and only the
+ * render thread calls sampleq_pop().  head and tail are free running
+ * and each is only ever written by one side, so no locking is needed.
+ *
+ * SAMPLEQ_SIZE must be a power of two.
+ */
+#define SAMPLEQ_SIZE 1024
+
+struct sampleq_s {
+	struct meter_sample_s slots[SAMPLEQ_SIZE];
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	std::atomic<uint32_t> dropped;
+};
+
+void sampleq_init( struct sampleq_s *q );
+bool sampleq_push( struct sampleq_s *q, const struct meter_sample_s *s );
+bool sampleq_pop( struct sampleq_s *q, struct meter_sample_s *s );
+size_t sampleq_depth( struct sampleq_s *q );
+
+#endif
@@ -0,0 +1,232 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flog.h"
+#include "trace.h"
+
+static const char *trace_names[TRACE_IDS] = {
+	"?", "cycle", "pipeline", "write", "settle", "read", "drain", "format", "lines", "draw", "present", "export", "rasterise"
+};
+
+std::atomic<bool> trace_on(false);
+
+/*
+ * Flight recorder ring, any thread claims the next event with one
+ * fetch_add and overwrites whatever was there
+ */
+static struct trace_event_s *trace_ring = NULL;
+static size_t trace_size = 0;
+static std::atomic<uint64_t> trace_next(0);
+static uint64_t trace_epoch = 0;
+
+static char trace_threads[TRACE_THREADS_MAX][TRACE_NAME_SIZE];
+static std::atomic<int> trace_thread_count(0);
+static thread_local int trace_tid = -1;
+
+static uint64_t trace_now( void ) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int trace_init( size_t events ) {
+	size_t size = 1;
+
+	while (size < events) size <<= 1;
+
+	trace_ring = (struct trace_event_s *)calloc(size, sizeof(struct trace_event_s));
+	if (!trace_ring) {
+		flog("trace: could not allocate %ld events\n", (long)size);
+		return 1;
+	}
+	trace_size = size;
+	trace_next.store(0);
+	trace_epoch = trace_now();
+	trace_on.store(true);
+
+	return 0;
+}
+
+void trace_free( void ) {
+	trace_on.store(false);
+	free(trace_ring);
+	trace_ring = NULL;
+	trace_size = 0;
+}
+
+/*
+ * Give the calling thread its row in the trace, unnamed threads
+ * get one on their first event
+ */
+void trace_thread( const char *name ) {
+	if (trace_tid < 0) {
+		trace_tid = trace_thread_count.fetch_add(1);
+		if (trace_tid >= TRACE_THREADS_MAX) trace_tid = TRACE_THREADS_MAX -1;
+	}
+	snprintf(trace_threads[trace_tid], TRACE_NAME_SIZE, "%s", name);
+}
+
+void trace_record( int id, int phase, uint64_t a, uint64_t b ) {
+	struct trace_event_s *e;
+
+	if (!trace_ring) return;
+	if (trace_tid < 0) {
+		char name[TRACE_NAME_SIZE];
+		snprintf(name, sizeof(name), "thread %d", trace_thread_count.load());
+		trace_thread(name);
+	}
+
+	e = &(trace_ring[trace_next.fetch_add(1, std::memory_order_relaxed) & (trace_size -1)]);
+	e->ts = trace_now() -trace_epoch;
+	e->id = id;
+	e->phase = phase;
+	e->tid = trace_tid;
+	e->a = a;
+	e->b = b;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: trace_save
+  Returns Type	: int
+  ----Parameter List
+  1. const std::filesystem::path &filename,
+  ------------------
+  Exit Codes	: 0 - ok, 1 - failed
+  Side Effects	: stops recording
+  --------------------------------------------------------------------
+Comments:
+  Call once every traced thread has finished, the ring is written
+  out oldest first with no locking.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int trace_save( const std::filesystem::path &filename ) {
+	struct trace_file_s h;
+	std::ofstream f;
+	uint64_t next, first, i;
+
+	if (!trace_ring) return 1;
+	trace_on.store(false);
+
+	next = trace_next.load();
+	first = (next > trace_size) ? next -trace_size : 0;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TRACE_MAGIC, 4);
+	h.version = TRACE_VERSION;
+	h.event_size = sizeof(struct trace_event_s);
+	h.count = (uint32_t)(next -first);
+	h.lost = first;
+	memcpy(h.threads, trace_threads, sizeof(h.threads));
+
+	f.open(filename, std::ios::binary);
+	if (!f.is_open()) {
+		flog("trace: could not write %s\n", filename.string().c_str());
+		return 1;
+	}
+	f.write((const char *)&h, sizeof(h));
+	for (i = first; i < next; i++) {
+		f.write((const char *)&(trace_ring[i & (trace_size -1)]), sizeof(struct trace_event_s));
+	}
+	f.close();
+
+	flog("trace: %u events saved to %s ( %llu lost )\n", h.count, filename.string().c_str(), (unsigned long long)h.lost);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: trace_export_json
+  Returns Type	: int
+  ----Parameter List
+  1. const std::filesystem::path &trace, saved by trace_save()
+  2. const std::filesystem::path &json, to write
+  ------------------
+  Exit Codes	: 0 - ok, 1 - failed
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Chrome trace event format, loads in chrome://tracing and
+  ui.perfetto.dev.  Spans are B/E pairs on one row per thread,
+  timestamps in microseconds from the start of the recording.
+
+  A ring that wrapped can start with ends whose begins were
+  overwritten, those are skipped so the viewer doesn't nest
+  everything under them.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int trace_export_json( const std::filesystem::path &trace, const std::filesystem::path &json ) {
+	struct trace_file_s h;
+	struct trace_event_s e;
+	std::ifstream in;
+	std::ofstream out;
+	int depth[TRACE_THREADS_MAX] = {};
+	bool first = true;
+	uint32_t i;
+	int t;
+
+	in.open(trace, std::ios::binary);
+	if (!in.is_open()) {
+		fprintf(stderr, "Could not open %s\n", trace.string().c_str());
+		return 1;
+	}
+	in.read((char *)&h, sizeof(h));
+	if (!in || memcmp(h.magic, TRACE_MAGIC, 4) != 0 || h.version != TRACE_VERSION || h.event_size != sizeof(e)) {
+		fprintf(stderr, "%s is not a trace file\n", trace.string().c_str());
+		return 1;
+	}
+
+	out.open(json, std::ios::binary);
+	if (!out.is_open()) {
+		fprintf(stderr, "Could not write %s\n", json.string().c_str());
+		return 1;
+	}
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for (t = 0; t < TRACE_THREADS_MAX; t++) {
+		char name[TRACE_NAME_SIZE +1];
+
+		if (!h.threads[t][0]) continue;
+		memcpy(name, h.threads[t], TRACE_NAME_SIZE);
+		name[TRACE_NAME_SIZE] = '\0';
+		out << fmt::format("{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+				first ? "" : ",\n", t, name);
+		first = false;
+	}
+
+	for (i = 0; i < h.count; i++) {
+		in.read((char *)&e, sizeof(e));
+		if (!in) break;
+		if (e.tid >= TRACE_THREADS_MAX) continue;
+
+		if (e.phase == TRACE_BEGIN) depth[e.tid]++;
+		else if (e.phase == TRACE_END) {
+			if (depth[e.tid] == 0) continue;
+			depth[e.tid]--;
+		}
+
+		out << fmt::format("{}{{\"name\":\"{}\",\"ph\":\"{:c}\",\"ts\":{}.{:03},\"pid\":1,\"tid\":{}",
+				first ? "" : ",\n", trace_names[e.id < TRACE_IDS ? e.id : 0], (char)e.phase,
+				e.ts / 1000, e.ts % 1000, e.tid);
+		if (e.phase == TRACE_INSTANT) out << ",\"s\":\"t\"";
+		if (e.a || e.b) out << fmt::format(",\"args\":{{\"a\":{},\"b\":{}}}", e.a, e.b);
+		out << "}";
+		first = false;
+	}
+	out << "\n]}\n";
+	out.close();
+
+	printf("%u events ( %llu lost before the save ) written to %s\n", i, (unsigned long long)h.lost, json.string().c_str());
+
+	return 0;
+}
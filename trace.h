@@ -0,0 +1,80 @@
+#ifndef __TRACE__
+#define __TRACE__
+#include <atomic>
+#include <filesystem>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_EVENTS_DEFAULT 65536  // power of two, oldest are overwritten
+#define TRACE_THREADS_MAX 16
+#define TRACE_NAME_SIZE 16
+#define TRACE_MAGIC "BK5T"
+#define TRACE_VERSION 1
+
+/*
+ * What a span covers, the id in every event
+ */
+#define TRACE_CYCLE 1           // one acquisition loop
+#define TRACE_PIPELINE 2        // pipeline_run(), a = requests
+#define TRACE_WRITE 3           // WriteRaw(), a = bytes
+#define TRACE_SETTLE 4          // WriteRequest()'s pacing delay
+#define TRACE_READ 5            // ReadResponse(), a = TRANSPORT_* result
+#define TRACE_DRAIN 6           // render thread emptying the sample queue, a = samples
+#define TRACE_FORMAT 7          // format_sample()
+#define TRACE_LINES 8           // atlas_line_update() for both lines, a/b = cells redrawn
+#define TRACE_DRAW 9            // clear and composite
+#define TRACE_PRESENT 10        // SDL_RenderPresent()
+#define TRACE_EXPORT 11         // frame_export_write()
+#define TRACE_RASTERISE 12      // font cache building a size, a/b = point sizes
+#define TRACE_IDS 13
+
+#define TRACE_BEGIN 'B'
+#define TRACE_END 'E'
+#define TRACE_INSTANT 'i'
+
+/*
+ * One fixed size record
+ */
+struct trace_event_s {
+	uint64_t ts;            // steady clock, ns
+	uint16_t id;            // TRACE_*
+	uint8_t phase;          // TRACE_BEGIN, TRACE_END, TRACE_INSTANT
+	uint8_t tid;            // slot in the thread name table
+	uint32_t reserved;
+	uint64_t a, b;          // payload
+};
+
+/*
+ * Saved trace file, the header then count events oldest first
+ */
+struct trace_file_s {
+	char magic[4];          // TRACE_MAGIC
+	uint32_t version;
+	uint32_t event_size;    // sizeof(struct trace_event_s)
+	uint32_t count;
+	uint64_t lost;          // overwritten before the save
+	char threads[TRACE_THREADS_MAX][TRACE_NAME_SIZE];
+};
+
+extern std::atomic<bool> trace_on;
+
+int trace_init( size_t events );
+void trace_free( void );
+void trace_thread( const char *name );
+void trace_record( int id, int phase, uint64_t a, uint64_t b );
+int trace_save( const std::filesystem::path &filename );
+int trace_export_json( const std::filesystem::path &trace, const std::filesystem::path &json );
+
+/*
+ * Cheap enough to leave in the hot paths, one relaxed load when
+ * tracing is off
+ */
+static inline void trace_begin( int id, uint64_t a = 0, uint64_t b = 0 ) {
+	if (trace_on.load(std::memory_order_relaxed)) trace_record(id, TRACE_BEGIN, a, b);
+}
+
+static inline void trace_end( int id, uint64_t a = 0, uint64_t b = 0 ) {
+	if (trace_on.load(std::memory_order_relaxed)) trace_record(id, TRACE_END, a, b);
+}
+
+#endif
@@ -0,0 +1,934 @@
+#include <chrono>
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#define MSG_NOSIGNAL 0 // no SIGPIPE to worry about
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#define INVALID_SOCKET -1
+#define closesocket close
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS, SO_NOSIGPIPE is set on the socket instead
+#endif
+#endif
+
+#include "flog.h"
+#include "transport.h"
+
+static uint64_t transport_millis( void ) {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: serial_params_parse
+  Returns Type	: int
+  ----Parameter List
+  1. const char *str, ie "9600", "115200:8n1", "57600:8e1:rtscts"
+  2. struct serial_params_s *sp, filled in, unspecified parts default to 8n1 no flow control
+  ------------------
+  Exit Codes	: 0 - ok, 1 - unparsable ( sp is left at 9600:8n1 )
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int serial_params_parse( const char *str, struct serial_params_s *sp ) {
+	const char *p;
+	char *ep;
+
+	sp->baud = 9600;
+	sp->data_bits = 8;
+	sp->parity = 'n';
+	sp->stop_bits = 1;
+	sp->flow = FLOW_NONE;
+
+	if (!str || !*str) return 0;
+
+	long baud = strtol(str, &ep, 10);
+	if (ep == str || baud <= 0) return 1;
+
+	p = ep;
+	if (*p == ':') {
+		p++;
+		if (p[0] < '5' || p[0] > '8') return 1;
+		if (!strchr("neoNEO", p[1]) || !p[1]) return 1;
+		if (p[2] != '1' && p[2] != '2') return 1;
+		sp->data_bits = p[0] - '0';
+		sp->parity = tolower(p[1]);
+		sp->stop_bits = p[2] - '0';
+		p += 3;
+
+		if (*p == ':') {
+			p++;
+			if (strcmp(p, "rtscts") == 0) sp->flow = FLOW_RTSCTS;
+			else if (strcmp(p, "xonxoff") == 0) sp->flow = FLOW_XONXOFF;
+			else if (strcmp(p, "none") == 0) sp->flow = FLOW_NONE;
+			else return 1;
+		} else if (*p) {
+			return 1;
+		}
+	} else if (*p) {
+		return 1;
+	}
+
+	sp->baud = baud;
+
+	return 0;
+}
+
+
+/*
+ * Receive ring
+ *
+ */
+void rxbuf_reset( struct rxbuf_s *rx ) {
+	rx->head = rx->tail = rx->scanned = 0;
+}
+
+size_t rxbuf_used( struct rxbuf_s *rx ) {
+	return rx->head - rx->tail;
+}
+
+size_t rxbuf_free( struct rxbuf_s *rx ) {
+	return RXBUF_SIZE - rxbuf_used(rx);
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: rxbuf_pop_frame
+  Returns Type	: int
+  ----Parameter List
+  1. struct rxbuf_s *rx, ring to take the frame from
+  2. char *buffer, destination for the \0 terminated frame
+  3. size_t buf_limit, size of buffer
+  ------------------
+  Exit Codes	: 0 - no complete frame buffered yet
+                 1 - frame copied
+                 2 - frame copied but truncated to fit buffer
+  Side Effects	: consumes the frame and its '\n' from the ring,
+                 any bytes following it stay buffered
+  --------------------------------------------------------------------
+Comments:
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int rxbuf_pop_frame( struct rxbuf_s *rx, char *buffer, size_t buf_limit ) {
+	size_t used = rxbuf_used(rx);
+	size_t i, flen, copy;
+
+	for (i = rx->scanned; i < used; i++) {
+		if (rx->data[(rx->tail +i) % RXBUF_SIZE] == '\n') break;
+	}
+
+	if (i == used) {
+		rx->scanned = used;
+		return 0;
+	}
+
+	flen = i;
+	copy = flen;
+	if (copy > buf_limit -1) copy = buf_limit -1;
+
+	for (i = 0; i < copy; i++) {
+		buffer[i] = rx->data[(rx->tail +i) % RXBUF_SIZE];
+	}
+	buffer[copy] = '\0';
+
+	rx->tail += flen +1; // drop the '\n' too
+	rx->scanned = 0;
+
+	return (copy < flen) ? 2 : 1;
+}
+
+/*
+ * As a backend Read() would leave it, straight in at head
+ */
+static void rxbuf_test_fill( struct rxbuf_s *rx, const char *s ) {
+	while (*s) {
+		rx->data[rx->head % RXBUF_SIZE] = *s++;
+		rx->head++;
+	}
+}
+
+static int rxbuf_test_pop( struct rxbuf_s *rx, size_t limit, int want_r, const char *want ) {
+	char buf[64];
+	int r = rxbuf_pop_frame(rx, buf, limit);
+
+	if (r != want_r || (r && strcmp(buf, want) != 0)) {
+		fprintf(stderr, "rxbuf: wanted %d '%s', got %d '%s'\n", want_r, want, r, r ? buf : "");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: rxbuf_selftest
+  Returns Type	: int
+  ----Parameter List
+  1. void,
+  ------------------
+  Exit Codes	: 0 - ok, 1 - a frame came out wrong
+  Side Effects	: prints the first failure to stderr
+  --------------------------------------------------------------------
+Comments:
+  Run by bk5490c -T.  Covers a frame arriving in pieces ( and the
+  scanned resume ), a frame split across the end of data[], two
+  frames in one read and a frame too long for the caller's buffer.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int rxbuf_selftest( void ) {
+	struct rxbuf_s *rx = new rxbuf_s;
+	int r = 0;
+
+	// Partial frame, then the rest of it
+	//
+	rxbuf_reset(rx);
+	rxbuf_test_fill(rx, "+1.2345");
+	r |= rxbuf_test_pop(rx, 64, 0, "");
+	if (rx->scanned != 7) {
+		fprintf(stderr, "rxbuf: scanned %ld after a partial frame, wanted 7\n", (long)rx->scanned);
+		r = 1;
+	}
+	rxbuf_test_fill(rx, "6E+0\n");
+	r |= rxbuf_test_pop(rx, 64, 1, "+1.23456E+0");
+	r |= rxbuf_test_pop(rx, 64, 0, "");
+
+	// Frame running over the end of data[], free running counters
+	// well past RXBUF_SIZE
+	//
+	rxbuf_reset(rx);
+	rx->head = rx->tail = (RXBUF_SIZE * 3) -4;
+	rxbuf_test_fill(rx, "VOLT:DC");
+	r |= rxbuf_test_pop(rx, 64, 0, "");
+	rxbuf_test_fill(rx, "\n");
+	r |= rxbuf_test_pop(rx, 64, 1, "VOLT:DC");
+
+	// Two frames in one read, the second left buffered
+	//
+	rxbuf_reset(rx);
+	rxbuf_test_fill(rx, "1\n+0.5,+0.6\n+0.");
+	r |= rxbuf_test_pop(rx, 64, 1, "1");
+	r |= rxbuf_test_pop(rx, 64, 1, "+0.5,+0.6");
+	r |= rxbuf_test_pop(rx, 64, 0, "");
+	if (rxbuf_used(rx) != 3) {
+		fprintf(stderr, "rxbuf: %ld bytes left buffered, wanted 3\n", (long)rxbuf_used(rx));
+		r = 1;
+	}
+
+	// Undersized buffer, truncated but the whole frame is consumed
+	//
+	rxbuf_reset(rx);
+	rxbuf_test_fill(rx, "BK Precision,5492C\nOK\n");
+	r |= rxbuf_test_pop(rx, 8, 2, "BK Prec");
+	r |= rxbuf_test_pop(rx, 8, 1, "OK");
+
+	delete rx;
+
+	return r;
+}
+
+
+/*
+ * Common transport parts
+ *
+ */
+Transport::Transport(void) {
+	name[0] = '\0';
+	rxbuf_reset(&rx);
+}
+
+void Transport::Purge(void) {
+	rxbuf_reset(&rx);
+}
+
+/*
+ * Read straight in to the free space of the ring.  If the free space
+ * wraps we only take the contiguous part, the rest comes next call.
+ *
+ * Returns bytes added, 0 on timeout, -1 on error
+ */
+int Transport::Fill(int timeout_ms) {
+	size_t idx = rx.head % RXBUF_SIZE;
+	size_t want = rxbuf_free(&rx);
+	int r;
+
+	if (want > RXBUF_SIZE - idx) want = RXBUF_SIZE - idx;
+	if (want == 0) return 0;
+
+	r = Read(rx.data +idx, want, timeout_ms);
+	if (r > 0) rx.head += r;
+
+	return r;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: Transport::ReadFrame
+  Returns Type	: int
+  ----Parameter List
+  1. char *buffer, destination for the response
+  2. size_t buf_limit, size of buffer
+  3. int timeout_ms, how long to wait for a complete frame, <0 forever
+  ------------------
+  Exit Codes	: TRANSPORT_OK, TRANSPORT_TRUNCATED, TRANSPORT_TIMEOUT
+                 or TRANSPORT_ERROR
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  Hands out the next '\n' terminated response, pulling as much as
+  is available from the backend per Read() call.  Anything after
+  the frame stays in the ring for the next call.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+int Transport::ReadFrame(char *buffer, size_t buf_limit, int timeout_ms) {
+	uint64_t deadline = transport_millis() + (timeout_ms < 0 ? 0 : timeout_ms);
+	int r;
+
+	buffer[0] = '\0';
+
+	while (1) {
+		int slice = 100;
+
+		// Hand out a complete frame if we already have one buffered
+		//
+		//
+		r = rxbuf_pop_frame(&rx, buffer, buf_limit);
+		if (r == 1) return TRANSPORT_OK;
+		if (r == 2) {
+			flog("%s: Buffer limit reached for supplied buffer (%d bytes)\n", name, buf_limit);
+			return TRANSPORT_TRUNCATED;
+		}
+
+		// A full ring with no '\n' in it is never going to
+		// resolve itself, so dump it and start over
+		//
+		//
+		if (rxbuf_free(&rx) == 0) {
+			flog("%s: Receive ring full without end-of-frame, discarding %d bytes\n", name, RXBUF_SIZE);
+			rxbuf_reset(&rx);
+		}
+
+		if (timeout_ms >= 0) {
+			uint64_t now = transport_millis();
+			if (now >= deadline) return TRANSPORT_TIMEOUT;
+			if (deadline - now < (uint64_t)slice) slice = deadline - now;
+		}
+
+		if (Fill(slice) < 0) return TRANSPORT_ERROR;
+	}
+
+	return TRANSPORT_OK;
+}
+
+
+#ifdef _WIN32
+/*
+ * Win32 COM port
+ *
+ */
+Win32SerialTransport::Win32SerialTransport(const char *device, const struct serial_params_s *sp) {
+	snprintf(name, sizeof(name), "%s", device);
+	params = *sp;
+	hComm = INVALID_HANDLE_VALUE;
+	read_timeout = -1;
+}
+
+Win32SerialTransport::~Win32SerialTransport(void) {
+	Close();
+}
+
+int Win32SerialTransport::Open(void) {
+	wchar_t com_port[TRANSPORT_NAME_SIZE +8]; // com port path / ie, \\.\COM4
+	size_t i;
+
+	flog("Win32SerialTransport: Port %s requested for opening...\n", name);
+
+	/*
+	 * Ports past COM9 only open via the \\.\ device namespace,
+	 * the port names are plain ASCII so just widen them
+	 */
+	wcscpy(com_port, L"\\\\.\\");
+	for (i = 0; name[i] && i < TRANSPORT_NAME_SIZE -1; i++) com_port[4 +i] = name[i];
+	com_port[4 +i] = L'\0';
+
+	/*
+	 * Open the serial port
+	 */
+	hComm = CreateFile(com_port,      // Name of port
+			GENERIC_READ|GENERIC_WRITE,  // Read Access
+			0,             // No Sharing
+			0,          // No Security
+			OPEN_EXISTING, // Open existing port only
+			FILE_ATTRIBUTE_NORMAL,             // Non overlapped I/O
+			0);         // Null for comm devices
+
+	/*
+	 * Check the outcome of the attempt to create the handle for the com port
+	 */
+	if (hComm == INVALID_HANDLE_VALUE) {
+		flog("Error while trying to open com port '%s'\r\n", name);
+		return 1;
+	} else {
+		flog("Win32SerialTransport: Port %s Opened\r\n", name);
+	}
+
+	if (SetParams(&params) != 0) {
+		Close();
+		return 1;
+	}
+
+	read_timeout = -1;
+	if (Read(NULL, 0, 100) < 0) {
+		flog("Error in setting time-outs\r\n");
+		Close();
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Set serial port parameters
+ */
+int Win32SerialTransport::SetParams(const struct serial_params_s *sp) {
+	BOOL com_read_status;  // return status of various com port functions
+	DCB dcbSerialParams = {0}; // Init DCB structure
+	dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
+
+	com_read_status = GetCommState(hComm, &dcbSerialParams); // Retrieve current settings
+	if (com_read_status == FALSE) {
+		flog("Error in getting GetCommState()\r\n");
+		return 1;
+	}
+
+	dcbSerialParams.BaudRate = sp->baud;
+	dcbSerialParams.ByteSize = sp->data_bits;
+	dcbSerialParams.StopBits = (sp->stop_bits == 2) ? TWOSTOPBITS : ONESTOPBIT;
+	switch (sp->parity) {
+		case 'e': dcbSerialParams.Parity = EVENPARITY; break;
+		case 'o': dcbSerialParams.Parity = ODDPARITY; break;
+		default: dcbSerialParams.Parity = NOPARITY; break;
+	}
+	dcbSerialParams.fParity = (sp->parity != 'n');
+
+	dcbSerialParams.fOutxCtsFlow = (sp->flow == FLOW_RTSCTS);
+	dcbSerialParams.fRtsControl = (sp->flow == FLOW_RTSCTS) ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
+	dcbSerialParams.fOutX = dcbSerialParams.fInX = (sp->flow == FLOW_XONXOFF);
+
+	com_read_status = SetCommState(hComm, &dcbSerialParams);
+	if (com_read_status == FALSE) {
+		flog("Error setting com port configuration (%d:%d%c%d)\r\n", sp->baud, sp->data_bits, sp->parity, sp->stop_bits);
+		return 1;
+	} else {
+		flog("\tBaudrate = %ld\r\n", dcbSerialParams.BaudRate);
+		flog("\tByteSize = %ld\r\n", dcbSerialParams.ByteSize);
+		flog("\tStopBits = %d\r\n", dcbSerialParams.StopBits);
+		flog("\tParity   = %d\r\n", dcbSerialParams.Parity);
+		flog("\tFlow     = %d\r\n", sp->flow);
+	}
+
+	params = *sp;
+
+	return 0;
+}
+
+void Win32SerialTransport::Close(void) {
+	if (hComm != INVALID_HANDLE_VALUE) {
+		CloseHandle(hComm);
+		hComm = INVALID_HANDLE_VALUE;
+	}
+}
+
+bool Win32SerialTransport::Write(const char *buf, size_t len) {
+	OVERLAPPED osWrite = {0};
+	DWORD dwWritten;
+	bool fRes;
+
+	// Create this writes OVERLAPPED structure hEvent.
+	osWrite.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (osWrite.hEvent == NULL)
+		// Error creating overlapped event handle.
+		return false;
+
+	// Issue write.
+	if (!WriteFile(hComm, buf, len, &dwWritten, &osWrite)) {
+		if (GetLastError() != ERROR_IO_PENDING) {
+			// WriteFile failed, but it isn't delayed. Report error and abort.
+			fRes = false;
+		} else {
+			// Write is pending.
+			if (!GetOverlappedResult(hComm, &osWrite, &dwWritten, TRUE)) {
+				fRes = false;
+			} else {
+				// Write operation completed successfully.
+				fRes = true;
+			}
+		}
+	} else {
+		// WriteFile completed immediately.
+		fRes = true;
+	}
+
+	CloseHandle(osWrite.hEvent);
+
+	return fRes;
+}
+
+/*
+ * With ReadIntervalTimeout and ReadTotalTimeoutMultiplier both MAXDWORD
+ * ReadFile() returns immediately with whatever is queued, or waits up to
+ * ReadTotalTimeoutConstant for the first byte to arrive.  That gives us a
+ * drain-everything read with a timeout in a single call.
+ */
+int Win32SerialTransport::Read(char *buf, size_t len, int timeout_ms) {
+	DWORD dwRead = 0;
+
+	if (timeout_ms != read_timeout) {
+		COMMTIMEOUTS timeouts = {0};
+
+		timeouts.ReadIntervalTimeout = MAXDWORD;
+		timeouts.ReadTotalTimeoutMultiplier = (timeout_ms > 0) ? MAXDWORD : 0;
+		timeouts.ReadTotalTimeoutConstant = (timeout_ms > 0) ? timeout_ms : 0;
+		timeouts.WriteTotalTimeoutConstant = 50;
+		timeouts.WriteTotalTimeoutMultiplier = 10;
+		if (SetCommTimeouts(hComm, &timeouts) == FALSE) {
+			flog("%s: Error in setting time-outs\r\n", name);
+			return -1;
+		}
+		read_timeout = timeout_ms;
+	}
+
+	if (len == 0) return 0;
+
+	if (!ReadFile(hComm, buf, len, &dwRead, NULL)) {
+		flog("%s: Error from ReadFile()\n", name);
+		return -1;
+	}
+
+	return dwRead;
+}
+
+void Win32SerialTransport::Purge(void) {
+	PurgeComm( hComm, PURGE_RXABORT|PURGE_RXCLEAR|PURGE_TXABORT|PURGE_TXCLEAR);
+	Transport::Purge();
+}
+
+#else
+/*
+ * POSIX termios serial device
+ *
+ */
+PosixSerialTransport::PosixSerialTransport(const char *device, const struct serial_params_s *sp) {
+	snprintf(name, sizeof(name), "%s", device);
+	params = *sp;
+	fd = -1;
+}
+
+PosixSerialTransport::~PosixSerialTransport(void) {
+	Close();
+}
+
+int PosixSerialTransport::Open(void) {
+
+	flog("PosixSerialTransport: Port %s requested for opening...\n", name);
+
+	fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		flog("Error while trying to open serial device '%s' (%s)\n", name, strerror(errno));
+		return 1;
+	}
+
+	if (SetParams(&params) != 0) {
+		Close();
+		return 1;
+	}
+
+	return 0;
+}
+
+static speed_t posix_speed( int baud ) {
+	switch (baud) {
+		case 1200: return B1200;
+		case 2400: return B2400;
+		case 4800: return B4800;
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B460800
+		case 460800: return B460800;
+#endif
+#ifdef B921600
+		case 921600: return B921600;
+#endif
+	}
+	return 0;
+}
+
+int PosixSerialTransport::SetParams(const struct serial_params_s *sp) {
+	struct termios tio;
+	speed_t speed = posix_speed(sp->baud);
+
+	if (!speed) {
+		flog("%s: unsupported baud rate %d\n", name, sp->baud);
+		return 1;
+	}
+
+	if (tcgetattr(fd, &tio) != 0) {
+		flog("%s: tcgetattr() failed (%s)\n", name, strerror(errno));
+		return 1;
+	}
+
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cflag |= (CLOCAL | CREAD);
+	tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+	switch (sp->data_bits) {
+		case 5: tio.c_cflag |= CS5; break;
+		case 6: tio.c_cflag |= CS6; break;
+		case 7: tio.c_cflag |= CS7; break;
+		default: tio.c_cflag |= CS8; break;
+	}
+	if (sp->parity == 'e') tio.c_cflag |= PARENB;
+	if (sp->parity == 'o') tio.c_cflag |= (PARENB | PARODD);
+	if (sp->stop_bits == 2) tio.c_cflag |= CSTOPB;
+	if (sp->flow == FLOW_RTSCTS) tio.c_cflag |= CRTSCTS;
+	if (sp->flow == FLOW_XONXOFF) tio.c_iflag |= (IXON | IXOFF);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		flog("Error setting serial configuration (%d:%d%c%d) on %s (%s)\n", sp->baud, sp->data_bits, sp->parity, sp->stop_bits, name, strerror(errno));
+		return 1;
+	}
+
+	flog("PosixSerialTransport: Port %s set to %d:%d%c%d flow %d\n", name, sp->baud, sp->data_bits, sp->parity, sp->stop_bits, sp->flow);
+	params = *sp;
+
+	return 0;
+}
+
+void PosixSerialTransport::Close(void) {
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+}
+
+bool PosixSerialTransport::Write(const char *buf, size_t len) {
+	size_t sent = 0;
+
+	while (sent < len) {
+		ssize_t r = write(fd, buf +sent, len -sent);
+		if (r < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				struct pollfd pfd = { fd, POLLOUT, 0 };
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			flog("%s: write() failed (%s)\n", name, strerror(errno));
+			return false;
+		}
+		sent += r;
+	}
+
+	return true;
+}
+
+int PosixSerialTransport::Read(char *buf, size_t len, int timeout_ms) {
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	ssize_t r;
+
+	r = poll(&pfd, 1, timeout_ms);
+	if (r < 0) {
+		if (errno == EINTR) return 0;
+		flog("%s: poll() failed (%s)\n", name, strerror(errno));
+		return -1;
+	}
+	if (r == 0) return 0;
+
+	// An unplugged adapter shows up as POLLHUP straight away, with
+	// nothing ( or only what was left over ) to read
+	//
+	if (pfd.revents & (POLLERR | POLLNVAL)) {
+		flog("%s: port error\n", name);
+		return -1;
+	}
+	if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLIN)) {
+		flog("%s: port hung up\n", name);
+		return -1;
+	}
+
+	r = read(fd, buf, len);
+	if (r < 0) {
+		if (errno == EAGAIN || errno == EINTR) return 0;
+		flog("%s: read() failed (%s)\n", name, strerror(errno));
+		return -1;
+	}
+	if (r == 0) {
+		// poll() said readable, so nothing at all means end of file
+		//
+		flog("%s: port hung up\n", name);
+		return -1;
+	}
+
+	return r;
+}
+
+void PosixSerialTransport::Purge(void) {
+	tcflush(fd, TCIOFLUSH);
+	Transport::Purge();
+}
+#endif
+
+
+/*
+ * TCP SCPI-raw socket
+ *
+ */
+TcpTransport::TcpTransport(const char *h, int p) {
+	snprintf(host, sizeof(host), "%s", h);
+	port = p;
+	sock = INVALID_SOCKET;
+	snprintf(name, sizeof(name), "%s:%d", host, port);
+}
+
+TcpTransport::~TcpTransport(void) {
+	Close();
+}
+
+int TcpTransport::Open(void) {
+	struct addrinfo hints, *res, *ai;
+	char service[20];
+	int r;
+
+#ifdef _WIN32
+	static bool wsa_started = false;
+	if (!wsa_started) {
+		WSADATA wsa;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+			flog("WSAStartup() failed\n");
+			return 1;
+		}
+		wsa_started = true;
+	}
+#endif
+
+	flog("TcpTransport: connecting to %s...\n", name);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+
+	r = getaddrinfo(host, service, &hints, &res);
+	if (r != 0) {
+		flog("%s: getaddrinfo() failed (%d)\n", name, r);
+		return 1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (sock == INVALID_SOCKET) continue;
+		if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		closesocket(sock);
+		sock = INVALID_SOCKET;
+	}
+	freeaddrinfo(res);
+
+	if (sock == INVALID_SOCKET) {
+		flog("%s: unable to connect\n", name);
+		return 1;
+	}
+
+	/*
+	 * SCPI commands are tiny and latency bound, don't let Nagle
+	 * hold them back waiting for more data
+	 */
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+
+	/*
+	 * A peer that's gone away has to come back as a failed Write(),
+	 * not a SIGPIPE killing the whole process
+	 */
+#ifdef SO_NOSIGPIPE
+	setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (const char *)&one, sizeof(one));
+#endif
+
+	flog("TcpTransport: connected to %s\n", name);
+
+	return 0;
+}
+
+void TcpTransport::Close(void) {
+	if (sock != INVALID_SOCKET) {
+		closesocket(sock);
+		sock = INVALID_SOCKET;
+	}
+}
+
+bool TcpTransport::Write(const char *buf, size_t len) {
+	size_t sent = 0;
+
+	while (sent < len) {
+		int r = send(sock, buf +sent, len -sent, MSG_NOSIGNAL);
+		if (r <= 0) {
+			flog("%s: send() failed\n", name);
+			return false;
+		}
+		sent += r;
+	}
+
+	return true;
+}
+
+int TcpTransport::Read(char *buf, size_t len, int timeout_ms) {
+	fd_set rfds;
+	struct timeval tv;
+	int r;
+
+	FD_ZERO(&rfds);
+	FD_SET(sock, &rfds);
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	r = select(sock +1, &rfds, NULL, NULL, &tv);
+	if (r < 0) {
+		flog("%s: select() failed\n", name);
+		return -1;
+	}
+	if (r == 0) return 0;
+
+	r = recv(sock, buf, len, 0);
+	if (r == 0) {
+		flog("%s: connection closed by peer\n", name);
+		return -1;
+	}
+	if (r < 0) {
+		flog("%s: recv() failed\n", name);
+		return -1;
+	}
+
+	return r;
+}
+
+/*
+ * There's no driver buffer to flush on a socket, so just throw away
+ * anything that's already arrived
+ */
+void TcpTransport::Purge(void) {
+	char junk[1024];
+
+	while (Read(junk, sizeof(junk), 0) > 0);
+	Transport::Purge();
+}
+
+
+/*
+ * Factories
+ *
+ */
+Transport *transport_open_serial( const char *device, const struct serial_params_s *sp ) {
+	Transport *t;
+
+#ifdef _WIN32
+	t = new Win32SerialTransport(device, sp);
+#else
+	t = new PosixSerialTransport(device, sp);
+#endif
+
+	if (t->Open() != 0) {
+		delete t;
+		return NULL;
+	}
+
+	return t;
+}
+
+Transport *transport_open_tcp( const char *host, int port ) {
+	Transport *t = new TcpTransport(host, port);
+
+	if (t->Open() != 0) {
+		delete t;
+		return NULL;
+	}
+
+	return t;
+}
+
+/*
+ * Fill names[] with the serial ports present on the system,
+ * returns how many were found
+ */
+int transport_list_serial_ports( char names[][TRANSPORT_NAME_SIZE], int max ) {
+	int count = 0;
+
+#ifdef _WIN32
+	static TCHAR szDevices[65535];
+	unsigned long dwChars = QueryDosDevice(NULL, szDevices, 65535);
+	TCHAR *ptr = szDevices;
+
+	while (dwChars && count < max) {
+		int port;
+
+		if (swscanf(ptr, L"COM%d", &port) == 1) { // if it finds the format COM#
+			if (port >= 0) {
+				snprintf(names[count], TRANSPORT_NAME_SIZE, "COM%d", port);
+				count++;
+			}
+		}
+
+		// advance the string pointers to the next device
+		//
+		TCHAR *temp_ptr = wcschr(ptr, '\0');
+		dwChars -= (DWORD)((temp_ptr - ptr) / sizeof(TCHAR) + 1);
+		ptr = temp_ptr + 1;
+	}
+#else
+	std::error_code ec;
+
+	for (auto const &entry : std::filesystem::directory_iterator("/dev", ec)) {
+		std::string fn = entry.path().filename().string();
+
+		if (count >= max) break;
+		if (fn.rfind("ttyUSB", 0) == 0 || fn.rfind("ttyACM", 0) == 0) {
+			snprintf(names[count], TRANSPORT_NAME_SIZE, "%s", entry.path().string().c_str());
+			count++;
+		}
+	}
+#endif
+
+	return count;
+}
@@ -0,0 +1,145 @@
+#ifndef __TRANSPORT__
+#define __TRANSPORT__
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+typedef SOCKET transport_socket_t;
+#else
+typedef int transport_socket_t;
+#endif
+
+#define RXBUF_SIZE 16384
+#define TRANSPORT_NAME_SIZE 256
+#define TRANSPORT_PORTS_MAX 64
+#define DEFAULT_TCP_PORT 5025
+#define DEFAULT_SERIAL_PARAMS "9600:8n1"
+
+#define FLOW_NONE 0
+#define FLOW_RTSCTS 1
+#define FLOW_XONXOFF 2
+
+/*
+ * Line settings, written as baud[:framing[:flow]] ie "115200:8n1:rtscts"
+ */
+struct serial_params_s {
+	int baud;
+	int data_bits;
+	char parity;            // 'n', 'e', 'o'
+	int stop_bits;
+	int flow;               // FLOW_*
+};
+
+int serial_params_parse( const char *str, struct serial_params_s *sp );
+
+/*
+ * ReadFrame() results
+ */
+#define TRANSPORT_ERROR -1
+#define TRANSPORT_OK 0
+#define TRANSPORT_TRUNCATED 1
+#define TRANSPORT_TIMEOUT 2
+
+/*
+ * Receive ring buffer.
+ *
+ * head and tail are free running counters, masked down to an index
+ * when touching data[].  scanned remembers how far past tail we've
+ * already looked for a '\n' so a partial frame isn't searched twice.
+ */
+struct rxbuf_s {
+	char data[RXBUF_SIZE];
+	size_t head;
+	size_t tail;
+	size_t scanned;
+};
+
+void rxbuf_reset( struct rxbuf_s *rx );
+size_t rxbuf_used( struct rxbuf_s *rx );
+size_t rxbuf_free( struct rxbuf_s *rx );
+int rxbuf_pop_frame( struct rxbuf_s *rx, char *buffer, size_t buf_limit );
+int rxbuf_selftest( void );
+
+/*
+ * A byte pipe to the meter.
+ *
+ * Backends only have to move raw bytes, Read() returning whatever is
+ * available ( waiting up to timeout_ms for the first byte ).  Splitting
+ * the stream in to '\n' terminated SCPI responses is common to all of
+ * them and done by ReadFrame().
+ */
+struct Transport {
+	char name[TRANSPORT_NAME_SIZE];
+	struct rxbuf_s rx;
+
+	Transport(void);
+	virtual ~Transport(void) {}
+
+	virtual int Open(void) = 0;
+	virtual void Close(void) = 0;
+	virtual bool Write(const char *buf, size_t len) = 0;
+	virtual int Read(char *buf, size_t len, int timeout_ms) = 0;
+	virtual void Purge(void);
+	virtual int SetParams(const struct serial_params_s *sp) { return 0; }
+
+	int Fill(int timeout_ms);
+	int ReadFrame(char *buffer, size_t buf_limit, int timeout_ms);
+};
+
+#ifdef _WIN32
+struct Win32SerialTransport : Transport {
+	HANDLE hComm;
+	int read_timeout; // ms currently programmed in to the COMMTIMEOUTS
+	struct serial_params_s params;
+
+	Win32SerialTransport(const char *device, const struct serial_params_s *sp);
+	~Win32SerialTransport(void);
+	int Open(void);
+	void Close(void);
+	bool Write(const char *buf, size_t len);
+	int Read(char *buf, size_t len, int timeout_ms);
+	void Purge(void);
+	int SetParams(const struct serial_params_s *sp);
+};
+#else
+struct PosixSerialTransport : Transport {
+	int fd;
+	struct serial_params_s params;
+
+	PosixSerialTransport(const char *device, const struct serial_params_s *sp);
+	~PosixSerialTransport(void);
+	int Open(void);
+	void Close(void);
+	bool Write(const char *buf, size_t len);
+	int Read(char *buf, size_t len, int timeout_ms);
+	void Purge(void);
+	int SetParams(const struct serial_params_s *sp);
+};
+#endif
+
+/*
+ * Raw SCPI over a TCP socket ( port 5025 style ), for LAN attached
+ * meters or a serial-to-ethernet bridge.
+ */
+struct TcpTransport : Transport {
+	char host[TRANSPORT_NAME_SIZE];
+	int port;
+	transport_socket_t sock;
+
+	TcpTransport(const char *host, int port);
+	~TcpTransport(void);
+	int Open(void);
+	void Close(void);
+	bool Write(const char *buf, size_t len);
+	int Read(char *buf, size_t len, int timeout_ms);
+	void Purge(void);
+};
+
+Transport *transport_open_serial( const char *device, const struct serial_params_s *sp );
+Transport *transport_open_tcp( const char *host, int port );
+int transport_list_serial_ports( char names[][TRANSPORT_NAME_SIZE], int max );
+
+#endif
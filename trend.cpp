@@ -0,0 +1,230 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "flog.h"
+#include "pyramid.h"
+#include "trend.h"
+
+int trend_init( struct trend_s *t, int width, uint64_t span_ms ) {
+	if (width < 1) width = 1;
+
+	t->width = width;
+	t->span_ms = span_ms;
+	t->col_ms = span_ms / width;
+	if (t->col_ms < 1) t->col_ms = 1;
+	t->cols = (struct trend_col_s *)calloc(width, sizeof(struct trend_col_s));
+	if (!t->cols) {
+		flog("trend: could not allocate %d columns\n", width);
+		t->width = 0;
+		return 1;
+	}
+	trend_reset(t, -1);
+
+	return 0;
+}
+
+void trend_free( struct trend_s *t ) {
+	free(t->cols);
+	t->cols = NULL;
+	t->width = 0;
+}
+
+void trend_reset( struct trend_s *t, int mode ) {
+	int i;
+
+	for (i = 0; i < t->width; i++) t->cols[i].used = false;
+	t->first = 0;
+	t->start = 0;
+	t->mode = mode;
+	t->dirty = true;
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: trend_add
+  Returns Type	: void
+  ----Parameter List
+  1. struct trend_s *t,
+  2. uint64_t ts, when the reading was taken
+  3. double value,
+  4. int mode, MMODES_* of the reading
+  ------------------
+  Exit Codes	:
+  Side Effects	: scrolls the view if ts is past the right edge
+  --------------------------------------------------------------------
+Comments:
+  A change of function throws the view away, volts and ohms on the
+  same scale would be meaningless.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+void trend_add( struct trend_s *t, uint64_t ts, double value, int mode ) {
+	struct trend_col_s *c;
+	uint64_t col;
+
+	if (!t->width) return;
+
+	if (mode != t->mode) trend_reset(t, mode);
+
+	// First reading, put it in the rightmost column
+	//
+	if (t->start == 0) {
+		t->start = (ts > (uint64_t)(t->width -1) * t->col_ms) ? ts -(t->width -1) * t->col_ms : 0;
+		if (t->start == 0) t->start = 1;
+	}
+
+	if (ts < t->start) return; // older than the pane
+
+	col = (ts -t->start) / t->col_ms;
+
+	// Scroll left by however many columns we've run off the end
+	//
+	//
+	if (col >= (uint64_t)t->width) {
+		uint64_t shift = col -(t->width -1);
+
+		if (shift >= (uint64_t)t->width) {
+			trend_reset(t, mode);
+			t->start = ts -(t->width -1) * t->col_ms;
+		} else {
+			for (uint64_t i = 0; i < shift; i++) {
+				t->cols[t->first].used = false;
+				t->first = (t->first +1) % t->width;
+			}
+			t->start += shift * t->col_ms;
+		}
+		col = t->width -1;
+	}
+
+	c = &(t->cols[(t->first +col) % t->width]);
+	if (!c->used) {
+		c->min = c->max = value;
+		c->used = true;
+	} else {
+		if (value < c->min) c->min = value;
+		if (value > c->max) c->max = value;
+	}
+	t->dirty = true;
+}
+
+/*
+ * Refill the view from the decimation pyramid, after a resize or to
+ * switch the view over to another function.  One O(log n) range
+ * query per column, however much history is behind it.
+ */
+void trend_rebuild( struct trend_s *t, struct pyramid_s *p, uint64_t now, int mode ) {
+	int i;
+
+	trend_reset(t, mode);
+	if (!t->width) return;
+
+	// Early in the run the pane reaches back before the first reading,
+	// start it at 1 ( 0 being "unset" ) as trend_add() does
+	//
+	t->start = (now > (uint64_t)(t->width -1) * t->col_ms) ? now -(t->width -1) * t->col_ms : 1;
+	for (i = 0; i < t->width; i++) {
+		struct pyramid_node_s n;
+		uint64_t c0 = t->start +i * t->col_ms;
+
+		if (pyramid_query(p, c0, c0 +t->col_ms, &n)) {
+			t->cols[i].min = n.min;
+			t->cols[i].max = n.max;
+			t->cols[i].used = true;
+		}
+	}
+}
+
+/*-----------------------------------------------------------------\
+  Function Name	: trend_draw
+  Returns Type	: void
+  ----Parameter List
+  1. struct trend_s *t,
+  2. SDL_Renderer *renderer,
+  3. SDL_Rect *pane, where on the canvas to draw
+  4. SDL_Color color, trace
+  5. SDL_Color axis, frame
+  ------------------
+  Exit Codes	:
+  Side Effects	:
+  --------------------------------------------------------------------
+Comments:
+  The trace is auto-scaled to the columns present.  Each column
+  contributes its max and min as two points of one polyline, so the
+  envelope is drawn with a single SDL_RenderDrawLines() per unbroken
+  stretch of columns.
+
+--------------------------------------------------------------------
+Changes:
+
+\------------------------------------------------------------------*/
+void trend_draw( struct trend_s *t, SDL_Renderer *renderer, SDL_Rect *pane, SDL_Color color, SDL_Color axis ) {
+	static SDL_Point *points = NULL;
+	static int points_size = 0;
+	double lo = 0, hi = 0, scale;
+	bool any = false;
+	int i, n;
+
+	t->dirty = false;
+
+	SDL_SetRenderDrawColor(renderer, axis.r, axis.g, axis.b, SDL_ALPHA_OPAQUE);
+	SDL_RenderDrawRect(renderer, pane);
+
+	if (!t->width || pane->w < 3 || pane->h < 3) return;
+
+	if (points_size < t->width *2) {
+		free(points);
+		points_size = t->width *2;
+		points = (SDL_Point *)malloc(points_size * sizeof(SDL_Point));
+		if (!points) {
+			points_size = 0;
+			return;
+		}
+	}
+
+	for (i = 0; i < t->width; i++) {
+		struct trend_col_s *c = &(t->cols[i]);
+		if (!c->used) continue;
+		if (!any || c->min < lo) lo = c->min;
+		if (!any || c->max > hi) hi = c->max;
+		any = true;
+	}
+	if (!any) return;
+
+	// Pad the scale a little, and give a flat trace some height
+	//
+	if (hi -lo < 1e-12) {
+		double pad = (hi != 0.0) ? ((hi < 0) ? -hi : hi) * 0.01 : 1e-6;
+		lo -= pad;
+		hi += pad;
+	} else {
+		double pad = (hi -lo) * 0.05;
+		lo -= pad;
+		hi += pad;
+	}
+	scale = (pane->h -3) / (hi -lo);
+
+	SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, SDL_ALPHA_OPAQUE);
+
+	n = 0;
+	for (i = 0; i < t->width; i++) {
+		struct trend_col_s *c = &(t->cols[(t->first +i) % t->width]);
+		int x = pane->x +1 +(i * (pane->w -2)) / t->width;
+
+		if (!c->used) {
+			if (n) SDL_RenderDrawLines(renderer, points, n);
+			n = 0;
+			continue;
+		}
+
+		points[n].x = x;
+		points[n].y = pane->y +1 +(int)((hi -c->max) * scale);
+		n++;
+		points[n].x = x;
+		points[n].y = pane->y +1 +(int)((hi -c->min) * scale);
+		n++;
+	}
+	if (n) SDL_RenderDrawLines(renderer, points, n);
+}
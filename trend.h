@@ -0,0 +1,45 @@
+#ifndef __TREND__
+#define __TREND__
+#include <stdint.h>
+#include <SDL.h>
+
+#include "pyramid.h"
+
+#define DEFAULT_TREND_HEIGHT 120
+#define DEFAULT_TREND_SECONDS 60
+
+/*
+ * Envelope of the readings that fell in one pixel column
+ */
+struct trend_col_s {
+	double min, max;
+	bool used;
+};
+
+/*
+ * Strip chart view of the history, already decimated to one min/max
+ * pair per pixel column.  New readings fold straight in to their
+ * column so drawing costs the same however many readings are held.
+ *
+ * cols[] is a ring, cols[first] being the oldest column which covers
+ * start .. start +col_ms
+ */
+struct trend_s {
+	int width;              // columns, one per pixel
+	uint64_t span_ms;       // time across the whole pane
+	uint64_t col_ms;
+	uint64_t start;         // SDL ticks at the left edge
+	int first;
+	int mode;               // MMODES_* being shown, -1 for none yet
+	struct trend_col_s *cols;
+	bool dirty;             // changed since last drawn
+};
+
+int trend_init( struct trend_s *t, int width, uint64_t span_ms );
+void trend_free( struct trend_s *t );
+void trend_reset( struct trend_s *t, int mode );
+void trend_add( struct trend_s *t, uint64_t ts, double value, int mode );
+void trend_rebuild( struct trend_s *t, struct pyramid_s *p, uint64_t now, int mode );
+void trend_draw( struct trend_s *t, SDL_Renderer *renderer, SDL_Rect *pane, SDL_Color color, SDL_Color axis );
+
+#endif